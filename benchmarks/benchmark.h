@@ -0,0 +1,101 @@
+//===---------------------------- benchmark.h -----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Runs a measurement on several threads at once and prints its result as one
+// JSON object per line, shared by the benchmarks in this directory.
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static std::uint64_t elapsed_ns(Clock::time_point t0, Clock::time_point t1)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+// Releases all threads of a run at the same moment.
+class start_line
+{
+    std::atomic<unsigned> waiting_;
+public:
+    explicit start_line(unsigned n) : waiting_(n) {}
+    void arrive()
+    {
+        --waiting_;
+        while (waiting_.load() != 0)
+            std::this_thread::yield();
+    }
+};
+
+struct result
+{
+    std::uint64_t ops;
+    std::uint64_t total_ns;
+    std::vector<std::uint64_t> samples;  // latency of one operation, in ns
+};
+
+static std::uint64_t percentile(std::vector<std::uint64_t>& v, unsigned p)
+{
+    if (v.empty())
+        return 0;
+    std::size_t i = (v.size() - 1) * p / 100;
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+static void report(const char* name, unsigned threads, result& r)
+{
+    std::printf("{\"benchmark\": \"%s\", \"threads\": %u, \"ops\": %llu, "
+                "\"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, "
+                "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu}\n",
+                name, threads,
+                static_cast<unsigned long long>(r.ops),
+                r.ops ? double(r.total_ns) / r.ops : 0.0,
+                r.total_ns ? r.ops * 1e9 / r.total_ns : 0.0,
+                static_cast<unsigned long long>(percentile(r.samples, 50)),
+                static_cast<unsigned long long>(percentile(r.samples, 90)),
+                static_cast<unsigned long long>(percentile(r.samples, 99)));
+}
+
+// Runs body(thread_index, samples) on the given number of threads and
+// returns the combined samples.  The run takes as long as its slowest thread.
+template <class Body>
+static result run(unsigned threads, std::uint64_t ops, Body body)
+{
+    start_line start(threads);
+    std::vector<std::vector<std::uint64_t> > samples(threads);
+    std::vector<std::uint64_t> durations(threads);
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t)
+        pool.push_back(std::thread([&, t]() {
+            start.arrive();
+            Clock::time_point t0 = Clock::now();
+            body(t, samples[t]);
+            durations[t] = elapsed_ns(t0, Clock::now());
+        }));
+    for (unsigned t = 0; t < threads; ++t)
+        pool[t].join();
+    result r;
+    r.ops = ops;
+    r.total_ns = *std::max_element(durations.begin(), durations.end());
+    for (unsigned t = 0; t < threads; ++t)
+        r.samples.insert(r.samples.end(), samples[t].begin(), samples[t].end());
+    return r;
+}
+
+#endif  // BENCHMARK_H
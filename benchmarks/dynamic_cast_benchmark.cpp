@@ -0,0 +1,174 @@
+//===---------------------- dynamic_cast_benchmark.cpp --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Measures dynamic_cast with 1 to N threads on these hierarchies:
+//
+//   chain_down_D   - downcast to the most derived class of a chain of D
+//                    single inheritance classes
+//   chain_fail_D   - downcast in the same chain to a class the object isn't
+//   wide_cross     - cross cast between the first and last of 16 bases
+//   wide_down      - downcast from the last of 16 bases
+//   diamond_down   - downcast from a virtual base of a diamond
+//   diamond_cross  - cross cast between the two sides of a diamond
+//   diamond_fail   - cast from a virtual base to an unrelated class
+//   void_ptr       - dynamic_cast<void*> from a virtual base
+//
+// Every thread casts the same objects, so any state shared between threads
+// shows up as a slower run with more threads.  Results are printed to stdout
+// as one JSON object per line so that runs can be compared against a
+// baseline.  The defaults only take a moment; pass "<max threads> <scale>" on
+// the command line for a real measurement.
+
+#include "benchmark.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static std::size_t scale = 1;
+
+// One cast to measure.  cast() is called through a pointer so that the
+// compiler can't see the dynamic type of the object and fold the cast.
+struct cast_case
+{
+    std::string name;
+    const void* (*cast)(void*);
+    void* object;
+    const void* expected;
+};
+
+static std::vector<cast_case> cases;
+
+static void add_case(const std::string& name, const void* (*cast)(void*),
+                     void* object, const void* expected)
+{
+    cast_case c = {name, cast, object, expected};
+    assert(cast(object) == expected);
+    cases.push_back(c);
+}
+
+// Chains of single inheritance
+
+template <int N> struct Chain : Chain<N-1> {};
+template <> struct Chain<0> { virtual ~Chain() {} };
+
+template <int D>
+struct chain_cases
+{
+    static const void* down(void* p)
+        {return dynamic_cast<Chain<D>*>(static_cast<Chain<0>*>(p));}
+    static const void* fail(void* p)
+        {return dynamic_cast<Chain<D+1>*>(static_cast<Chain<0>*>(p));}
+
+    static void add()
+    {
+        Chain<D>* object = new Chain<D>;
+        Chain<0>* base = object;
+        char depth[8];
+        std::snprintf(depth, sizeof(depth), "%d", D);
+        add_case(std::string("chain_down_") + depth, down, base, object);
+        add_case(std::string("chain_fail_") + depth, fail, base, 0);
+    }
+};
+
+// Wide multiple inheritance
+
+template <int N> struct Wide { virtual ~Wide() {} };
+
+struct WideAll
+    : Wide<0>, Wide<1>, Wide<2>, Wide<3>, Wide<4>, Wide<5>, Wide<6>, Wide<7>,
+      Wide<8>, Wide<9>, Wide<10>, Wide<11>, Wide<12>, Wide<13>, Wide<14>, Wide<15>
+{
+};
+
+static const void* wide_cross(void* p)
+    {return dynamic_cast<Wide<15>*>(static_cast<Wide<0>*>(p));}
+static const void* wide_down(void* p)
+    {return dynamic_cast<WideAll*>(static_cast<Wide<15>*>(p));}
+
+// A virtual diamond, and a class that isn't part of it
+
+struct V { virtual ~V() {} };
+struct L : virtual V {};
+struct R : virtual V {};
+struct D : L, R {};
+struct Unrelated { virtual ~Unrelated() {} };
+
+static const void* diamond_down(void* p)
+    {return dynamic_cast<D*>(static_cast<V*>(p));}
+static const void* diamond_cross(void* p)
+    {return dynamic_cast<R*>(static_cast<L*>(p));}
+static const void* diamond_fail(void* p)
+    {return dynamic_cast<Unrelated*>(static_cast<V*>(p));}
+static const void* void_ptr(void* p)
+    {return dynamic_cast<void*>(static_cast<V*>(p));}
+
+static void add_cases()
+{
+    chain_cases<1>::add();
+    chain_cases<2>::add();
+    chain_cases<4>::add();
+    chain_cases<8>::add();
+    chain_cases<16>::add();
+    chain_cases<32>::add();
+    chain_cases<64>::add();
+
+    WideAll* wide = new WideAll;
+    add_case("wide_cross", wide_cross, static_cast<Wide<0>*>(wide),
+             static_cast<Wide<15>*>(wide));
+    add_case("wide_down", wide_down, static_cast<Wide<15>*>(wide), wide);
+
+    D* diamond = new D;
+    add_case("diamond_down", diamond_down, static_cast<V*>(diamond), diamond);
+    add_case("diamond_cross", diamond_cross, static_cast<L*>(diamond),
+             static_cast<R*>(diamond));
+    add_case("diamond_fail", diamond_fail, static_cast<V*>(diamond), 0);
+    add_case("void_ptr", void_ptr, static_cast<V*>(diamond), diamond);
+}
+
+// Casts are timed in batches since a single cast is close to the resolution
+// of the clock.
+static void measure(const cast_case& c, unsigned threads)
+{
+    const std::size_t batches = 1000 * scale;
+    const std::size_t batch = 64;
+    result r = run(threads, std::uint64_t(threads) * batches * batch,
+        [&](unsigned, std::vector<std::uint64_t>& samples) {
+            samples.reserve(batches);
+            for (std::size_t i = 0; i < batches; ++i)
+            {
+                Clock::time_point t0 = Clock::now();
+                for (std::size_t j = 0; j < batch; ++j)
+                    if (c.cast(c.object) != c.expected)
+                        std::abort();
+                Clock::time_point t1 = Clock::now();
+                samples.push_back(elapsed_ns(t0, t1) / batch);
+            }
+        });
+    report(c.name.c_str(), threads, r);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned max_threads = 4;
+    if (argc > 1)
+        max_threads = static_cast<unsigned>(std::atoi(argv[1]));
+    if (argc > 2)
+        scale = static_cast<std::size_t>(std::atoi(argv[2]));
+    add_cases();
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        if (threads * 2 > max_threads)
+            threads = max_threads;
+        for (std::size_t i = 0; i < cases.size(); ++i)
+            measure(cases[i], threads);
+    }
+}
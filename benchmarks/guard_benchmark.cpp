@@ -0,0 +1,133 @@
+//===------------------------- guard_benchmark.cpp ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Measures __cxa_guard_acquire/__cxa_guard_release with 1 to N threads in
+// three scenarios:
+//
+//   steady    - every thread checks a guard that is already initialized
+//   herd      - every thread races to initialize the same guard
+//   distinct  - every thread initializes its own set of guards
+//
+// Results are printed to stdout as one JSON object per line so that runs can
+// be compared against a baseline.  The defaults only take a moment; pass
+// "<max threads> <scale>" on the command line for a real measurement.
+
+#include "benchmark.h"
+#include "cxxabi.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#if __arm__
+typedef uint32_t guard_type;
+#else
+typedef uint64_t guard_type;
+#endif
+
+static std::size_t scale = 1;
+
+// Every call finds the guard already initialized.  Calls are timed in
+// batches since a single call is close to the resolution of the clock.
+static void steady(unsigned threads)
+{
+    const std::size_t batches = 1000 * scale;
+    const std::size_t batch = 64;
+    static guard_type guard = 0;
+    if (abi::__cxa_guard_acquire(&guard))
+        abi::__cxa_guard_release(&guard);
+    result r = run(threads, std::uint64_t(threads) * batches * batch,
+        [&](unsigned, std::vector<std::uint64_t>& samples) {
+            samples.reserve(batches);
+            for (std::size_t i = 0; i < batches; ++i)
+            {
+                Clock::time_point t0 = Clock::now();
+                for (std::size_t j = 0; j < batch; ++j)
+                    if (abi::__cxa_guard_acquire(&guard))
+                        std::abort();
+                Clock::time_point t1 = Clock::now();
+                samples.push_back(elapsed_ns(t0, t1) / batch);
+            }
+        });
+    report("steady", threads, r);
+}
+
+// All threads race for one fresh guard per round.  The winner holds it for
+// a short while so the others have to wait for the release.
+static void herd(unsigned threads)
+{
+    const std::size_t rounds = 50 * scale;
+    std::vector<guard_type> guards(rounds, 0);
+    std::vector<std::atomic<unsigned> > winners(rounds);
+    for (std::size_t i = 0; i < rounds; ++i)
+        winners[i] = 0;
+    result r = run(threads, std::uint64_t(threads) * rounds,
+        [&](unsigned, std::vector<std::uint64_t>& samples) {
+            samples.reserve(rounds);
+            for (std::size_t i = 0; i < rounds; ++i)
+            {
+                Clock::time_point t0 = Clock::now();
+                if (abi::__cxa_guard_acquire(&guards[i]))
+                {
+                    ++winners[i];
+                    std::this_thread::sleep_for(std::chrono::microseconds(20));
+                    abi::__cxa_guard_release(&guards[i]);
+                }
+                Clock::time_point t1 = Clock::now();
+                samples.push_back(elapsed_ns(t0, t1));
+            }
+        });
+    for (std::size_t i = 0; i < rounds; ++i)
+        assert(winners[i] == 1);
+    report("herd", threads, r);
+}
+
+// Each thread initializes guards that nobody else touches.  Neighbouring
+// threads' guards are interleaved in memory so that any sharing between
+// unrelated guards shows up.
+static void distinct(unsigned threads)
+{
+    const std::size_t per_thread = 10000 * scale;
+    std::vector<guard_type> guards(per_thread * threads, 0);
+    result r = run(threads, std::uint64_t(threads) * per_thread,
+        [&](unsigned t, std::vector<std::uint64_t>& samples) {
+            samples.reserve(per_thread);
+            for (std::size_t i = 0; i < per_thread; ++i)
+            {
+                guard_type* g = &guards[i * threads + t];
+                Clock::time_point t0 = Clock::now();
+                if (!abi::__cxa_guard_acquire(g))
+                    std::abort();
+                abi::__cxa_guard_release(g);
+                Clock::time_point t1 = Clock::now();
+                samples.push_back(elapsed_ns(t0, t1));
+            }
+        });
+    report("distinct", threads, r);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned max_threads = 4;
+    if (argc > 1)
+        max_threads = static_cast<unsigned>(std::atoi(argv[1]));
+    if (argc > 2)
+        scale = static_cast<std::size_t>(std::atoi(argv[2]));
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        if (threads * 2 > max_threads)
+            threads = max_threads;
+        steady(threads);
+        herd(threads);
+        distinct(threads);
+    }
+}
@@ -87,6 +87,13 @@ extern void __cxa_guard_release(uint64_t*);
 extern void __cxa_guard_abort(uint64_t*);
 #endif
 
+// libc++abi extension: print the top_n guards with the longest total wait
+// to stderr and return how many were printed.  Only calls that find the
+// guard not yet initialized are counted.  Statistics are only gathered when
+// libc++abi is built with LIBCXXABI_GUARD_PROFILE, otherwise this prints
+// nothing.
+extern size_t __cxa_guard_profile_dump(size_t top_n);
+
 // 3.3.3 Array Construction and Destruction API
 extern void* __cxa_vec_new(size_t element_count, 
                            size_t element_size, 
@@ -168,6 +175,108 @@ extern char* __cxa_demangle(const char* mangled_name,
                             size_t*     length, 
                             int*        status);
 
+// libc++abi extension: a demangler context keeps the memory the demangler
+// uses from one call to the next, so that once it has warmed up, demangling
+// with it allocates nothing beyond growing the output buffer.  A context may
+// only be used by one thread at a time.
+struct __cxa_demangle_context;
+extern __cxa_demangle_context* __cxa_demangle_context_create();
+extern void __cxa_demangle_context_destroy(__cxa_demangle_context* context);
+
+// Same as __cxa_demangle, using the memory of context.
+extern char* __cxa_demangle_with_context(__cxa_demangle_context* context,
+                                         const char* mangled_name,
+                                         char*       output_buffer,
+                                         size_t*     length,
+                                         int*        status);
+
+// Same as __cxa_demangle, but gives up once the demangled name would be
+// longer than max_length, or once max_steps types, expressions and
+// encodings have been parsed, whichever comes first.  Either limit may be 0
+// for none.  On giving up, status is set to -5 and what there is of the
+// name is returned followed by "...", in no more than max_length
+// characters.  context may be null.
+extern char* __cxa_demangle_bounded(__cxa_demangle_context* context,
+                                    const char* mangled_name,
+                                    char*       output_buffer,
+                                    size_t*     length,
+                                    int*        status,
+                                    size_t      max_length,
+                                    size_t      max_steps);
+
+// Demangles count names one after the other into output_buffer, each
+// followed by a null.  output_buffer is handled as by __cxa_demangle: it may
+// be null, or hold *length bytes from malloc, and is grown with realloc as
+// needed.  offsets[i] is set to the offset of the i-th demangled name in the
+// returned buffer, or to (size_t)-1 if it could not be demangled, and, if
+// statuses is not null, statuses[i] to its status.
+extern char* __cxa_demangle_batch(__cxa_demangle_context* context,
+                                  const char* const* mangled_names,
+                                  size_t      count,
+                                  char*       output_buffer,
+                                  size_t*     length,
+                                  size_t*     offsets,
+                                  int*        statuses);
+
+// libc++abi extension: the demangled name as a tree rather than a string.
+// The root of a function is a __cxa_demangle_node_function with, in order,
+// a return type if the name has one, a name, the parameters, and the
+// qualifiers if there are any.  The root of any other name in a namespace or
+// class is a __cxa_demangle_node_name, which, like the name of a function,
+// has a scope if it is qualified, a base name, and template arguments if it
+// ends in some.  Anything else is a __cxa_demangle_node_other with no
+// children.  The text of a node is the demangled text it covers, except for
+// a function, whose text is null: its whole name is given by
+// __cxa_demangle_tree_string.
+//
+// The tree is only this one level of pieces.  A return type, template
+// argument or parameter is a leaf with its text, and is not broken down
+// any further.  Nothing is rendered lazily: the whole name is built while
+// it is demangled, as by __cxa_demangle, and the tree is cut from it.
+enum
+{
+    __cxa_demangle_node_function,
+    __cxa_demangle_node_name,
+    __cxa_demangle_node_other,
+    __cxa_demangle_node_return_type,
+    __cxa_demangle_node_scope,
+    __cxa_demangle_node_base_name,
+    __cxa_demangle_node_template_args,
+    __cxa_demangle_node_template_arg,
+    __cxa_demangle_node_parameters,
+    __cxa_demangle_node_parameter,
+    __cxa_demangle_node_qualifiers
+};
+
+struct __cxa_demangle_node
+{
+    int                        kind;
+    const char*                text;
+    size_t                     child_count;
+    const __cxa_demangle_node* children;
+};
+
+// A tree is one block of memory, nodes and text together, that is valid
+// until it is destroyed.  context may be null.  status is set as by
+// __cxa_demangle.  A tree may only be used by one thread at a time.
+struct __cxa_demangle_tree;
+extern __cxa_demangle_tree* __cxa_demangle_tree_create(
+                                  __cxa_demangle_context* context,
+                                  const char* mangled_name,
+                                  int*        status);
+extern void __cxa_demangle_tree_destroy(__cxa_demangle_tree* tree);
+extern const __cxa_demangle_node* __cxa_demangle_tree_root(
+                                  const __cxa_demangle_tree* tree);
+
+// The first child of node of the given kind, or null if it has none.
+extern const __cxa_demangle_node* __cxa_demangle_node_child(
+                                  const __cxa_demangle_node* node,
+                                  int kind);
+
+// The whole demangled name, the same as from __cxa_demangle, kept with the
+// tree.
+extern const char* __cxa_demangle_tree_string(__cxa_demangle_tree* tree);
+
 // Apple additions to support C++ 0x exception_ptr class
 // These are primitives to wrap a smart pointer around an exception object
 extern void * __cxa_current_primary_exception() throw();
@@ -175,6 +284,13 @@ extern void __cxa_rethrow_primary_exception(void* primary_exception);
 extern void __cxa_increment_exception_refcount(void* primary_exception) throw();
 extern void __cxa_decrement_exception_refcount(void* primary_exception) throw();
 
+// Support for making an exception_ptr without throwing: fills in the header
+// of an object from __cxa_allocate_exception.  The reference count starts
+// at zero.
+struct __cxa_exception;
+extern __cxa_exception * __cxa_init_primary_exception(void * object,
+        std::type_info * tinfo, void (*dest)(void *)) throw();
+
 // Apple addition to support std::uncaught_exception()
 extern bool __cxa_uncaught_exception() throw();
 
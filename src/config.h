@@ -28,4 +28,70 @@
 #  define LIBCXXABI_BAREMETAL 0
 #endif
 
+// Keep the per-thread __cxa_eh_globals in initial-exec TLS instead of behind a
+// pthread key.  Set this to 0 in the CXXFLAGS if libc++abi has to be loaded
+// with dlopen, which initial-exec TLS does not reliably support.
+#ifndef LIBCXXABI_HAS_TLS_EH_GLOBALS
+#  if defined(__linux__) && !LIBCXXABI_HAS_NO_THREADS
+#    define LIBCXXABI_HAS_TLS_EH_GLOBALS 1
+#  else
+#    define LIBCXXABI_HAS_TLS_EH_GLOBALS 0
+#  endif
+#endif
+
+// The size in bytes of the emergency pool used for exceptions when malloc
+// fails.  It can also be set at startup with the
+// LIBCXXABI_EMERGENCY_POOL_SIZE environment variable.
+#ifndef LIBCXXABI_FALLBACK_HEAP_SIZE
+#  define LIBCXXABI_FALLBACK_HEAP_SIZE (32 * 1024)
+#endif
+
+// Set this in the CXXFLAGS to record per-guard contention statistics in
+// __cxa_guard_acquire, reported by __cxa_guard_profile_dump.
+#ifndef LIBCXXABI_GUARD_PROFILE
+#  define LIBCXXABI_GUARD_PROFILE 0
+#endif
+
+// The number of LSDAs whose call-site tables the personality routine keeps a
+// decoded, searchable index of.  Set this to 0 in the CXXFLAGS to always walk
+// the tables instead.
+#ifndef LIBCXXABI_LSDA_INDEX_SLOTS
+#  define LIBCXXABI_LSDA_INDEX_SLOTS 256
+#endif
+
+// The number of entries in the cache of which class types catch which
+// thrown class types.  Set this to 0 in the CXXFLAGS to disable the cache.
+#ifndef LIBCXXABI_CATCH_CACHE_SIZE
+#  define LIBCXXABI_CATCH_CACHE_SIZE 256
+#endif
+
+// The number of entries in the cache of __dynamic_cast results.  Set this to
+// 0 in the CXXFLAGS to disable the cache.  It is always disabled with
+// _LIBCXX_DYNAMIC_FALLBACK, so that every cast that runs into a hidden
+// type_info is reported, not just the first.
+#ifndef LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE
+#  define LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE 1024
+#endif
+#if _LIBCXX_DYNAMIC_FALLBACK
+#  undef  LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE
+#  define LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE 0
+#endif
+
+// The number of classes with several bases for which a flattened table of
+// all their bases is kept.  Set this to 0 in the CXXFLAGS to always search
+// the type_info hierarchy instead.
+#ifndef LIBCXXABI_BASE_TABLE_SLOTS
+#  define LIBCXXABI_BASE_TABLE_SLOTS 512
+#endif
+
+// The number of type names that are interned when type_info's are compared
+// by name, with _LIBCXX_DYNAMIC_FALLBACK or on Windows.  The interned
+// type_info's are kept for the life of the process and their names are read
+// again later, so this is only safe where libraries with type_info's are
+// never unloaded.  It is 0 by default, which compares names with strcmp;
+// set it in the CXXFLAGS, for example to 1024, to intern them.
+#ifndef LIBCXXABI_TYPE_NAME_SLOTS
+#  define LIBCXXABI_TYPE_NAME_SLOTS 0
+#endif
+
 #endif // LIBCXXABI_CONFIG_H
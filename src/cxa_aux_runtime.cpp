@@ -11,6 +11,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "cxxabi.h"
+#include "cxa_exception.hpp"
 #include <new>
 #include <typeinfo>
 
@@ -32,7 +33,7 @@ void __cxa_bad_typeid(void) {
 
 LIBCXXABI_NORETURN
 void __cxa_throw_bad_array_new_length(void) {
-    throw std::bad_array_new_length();
+    __throw_reserved_exception<std::bad_array_new_length>();
 }
 }  // extern "C"
 
@@ -10,8 +10,12 @@
 #define _LIBCPP_EXTERN_TEMPLATE(...)
 #define _LIBCPP_NO_EXCEPTIONS
 
+#include "config.h"
+#include "cxxabi.h"
+
 #include <vector>
 #include <algorithm>
+#include <new>
 #include <string>
 #include <numeric>
 #include <cstdlib>
@@ -26,6 +30,7 @@ namespace
 
 enum
 {
+    budget_exceeded = -5,
     unknown_error = -4,
     invalid_args = -3,
     invalid_mangled_name,
@@ -33,6 +38,59 @@ enum
     success
 };
 
+// Where the parts of a name are in its text: the scope is [0, scope_end),
+//   and the unqualified name, without its template arguments, is
+//   [base_begin, base_end).  parse_name leaves these in db.parts for the
+//   name it parsed.
+struct name_parts
+{
+    size_t scope_end;
+    size_t base_begin;
+    size_t base_end;
+};
+
+// What the outermost encoding of a mangled name is, as far as
+//   __cxa_demangle_tree_create is concerned
+enum encoding_kind
+{
+    other_encoding,
+    data_encoding,
+    function_encoding
+};
+
+// Splits a name known only by its text at its last "::" outside of
+//   template arguments and parentheses.
+template <class String>
+name_parts
+split_name(const String& name)
+{
+    name_parts parts = {0, 0, name.size()};
+    int depth = 0;
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        switch (name[i])
+        {
+        case '<':
+        case '(':
+            ++depth;
+            break;
+        case '>':
+        case ')':
+            --depth;
+            break;
+        case ':':
+            if (depth == 0 && i + 1 < name.size() && name[i+1] == ':')
+            {
+                parts.scope_end = i;
+                parts.base_begin = i + 2;
+                ++i;
+            }
+            break;
+        }
+    }
+    return parts;
+}
+
 template <class C>
     const char* parse_type(const char* first, const char* last, C& db);
 template <class C>
@@ -242,6 +300,80 @@ parse_source_name(const char* first, const char* last, C& db)
     return first;
 }
 
+// Marks a template parameter referred to before its arguments are known
+//   (see parse_template_param)
+
+const char forward_reference_mark = '\x01';
+
+// Removes the marks from s, leaving the references as written
+template <class String>
+void
+erase_forward_reference_marks(String& s)
+{
+    s.erase(std::remove(s.begin(), s.end(), forward_reference_mark), s.end());
+}
+
+// The budget of __cxa_demangle_bounded.  Each type, expression and
+//   encoding parsed costs a step, so the steps bound both the time taken and
+//   the depth of recursion.  No name may grow longer than max_length, which
+//   is checked where substitutions and template parameters copy names, the
+//   only places a name can grow faster than the mangled name is read.  Once
+//   over budget, spend and within_length fail every parse, so that the
+//   demangler gives up as quickly as it would on a bad name.  What the
+//   outermost name had come to when the budget ran out is kept in
+//   db.truncated.
+
+template <class C>
+void
+go_over_budget(C& db)
+{
+    if (db.over_budget)
+        return;
+    db.over_budget = true;
+    if (!db.names.empty())
+    {
+        db.truncated = db.names.front().first;
+        if (db.mark_forward_references)
+            erase_forward_reference_marks(db.truncated);
+        if (db.max_length != 0 && db.truncated.size() > db.max_length)
+            db.truncated.resize(db.max_length);
+    }
+}
+
+template <class C>
+inline
+bool
+spend(C& db)
+{
+    if (!db.limited)
+        return true;
+    if (db.steps_left == 0)
+    {
+        go_over_budget(db);
+        return false;
+    }
+    --db.steps_left;
+    return !db.over_budget;
+}
+
+template <class C>
+inline
+bool
+within_length(C& db, const typename C::sub_type& names)
+{
+    if (!db.limited || db.max_length == 0)
+        return true;
+    for (const auto& n : names)
+    {
+        if (n.size() > db.max_length)
+        {
+            go_over_budget(db);
+            return false;
+        }
+    }
+    return true;
+}
+
 // <substitution> ::= S <seq-id> _
 //                ::= S_
 // <substitution> ::= Sa # ::std::allocator
@@ -290,6 +422,8 @@ parse_substitution(const char* first, const char* last, C& db)
             case '_':
                 if (!db.subs.empty())
                 {
+                    if (!within_length(db, db.subs.front()))
+                        return first;
                     for (const auto& n : db.subs.front())
                         db.names.push_back(n);
                     first += 2;
@@ -317,6 +451,8 @@ parse_substitution(const char* first, const char* last, C& db)
                     ++sub;
                     if (sub < db.subs.size())
                     {
+                        if (!within_length(db, db.subs[sub]))
+                            return first;
                         for (const auto& n : db.subs[sub])
                             db.names.push_back(n);
                         first = t+1;
@@ -538,6 +674,14 @@ parse_cv_qualifiers(const char* first, const char* last, unsigned& cv)
 
 // <template-param> ::= T_    # first template parameter
 //                  ::= T <parameter-2 non-negative number> _
+//
+// A template parameter may be referred to before its template arguments
+//   have been parsed, as in the type of a templated conversion operator.
+//   Such a forward reference is left in the name as forward_reference_mark
+//   followed by the T_ or T<n>_ it stands for, and is filled in once the
+//   whole name has been parsed (see patch_forward_references).  A mangled
+//   name that has the mark in it already can't be patched, so for one the
+//   references are left as written, without marks.
 
 template <class C>
 const char*
@@ -553,13 +697,19 @@ parse_template_param(const char* first, const char* last, C& db)
                     return first;
                 if (!db.template_param.back().empty())
                 {
+                    if (!within_length(db, db.template_param.back().front()))
+                        return first;
                     for (auto& t : db.template_param.back().front())
                         db.names.push_back(t);
                     first += 2;
                 }
                 else
                 {
-                    db.names.push_back("T_");
+                    typename C::String r;
+                    if (db.mark_forward_references)
+                        r.push_back(forward_reference_mark);
+                    r.append(first, 2);
+                    db.names.push_back(std::move(r));
                     first += 2;
                     db.fix_forward_references = true;
                 }
@@ -578,13 +728,19 @@ parse_template_param(const char* first, const char* last, C& db)
                 ++sub;
                 if (sub < db.template_param.back().size())
                 {
+                    if (!within_length(db, db.template_param.back()[sub]))
+                        return first;
                     for (auto& temp : db.template_param.back()[sub])
                         db.names.push_back(temp);
                     first = t+1;
                 }
                 else
                 {
-                    db.names.push_back(typename C::String(first, t+1));
+                    typename C::String r;
+                    if (db.mark_forward_references)
+                        r.push_back(forward_reference_mark);
+                    r.append(first, t+1);
+                    db.names.push_back(std::move(r));
                     first = t+1;
                     db.fix_forward_references = true;
                 }
@@ -770,9 +926,12 @@ parse_sizeof_param_pack_expr(const char* first, const char* last, C& db)
             size_t k = k0;
             if (k != k1)
             {
-                tmp += db.names[k].move_full();
+                db.names[k].append_to(tmp);
                 for (++k; k != k1; ++k)
-                    tmp += ", " + db.names[k].move_full();
+                {
+                    tmp += ", ";
+                    db.names[k].append_to(tmp);
+                }
             }
             tmp += ")";
             for (; k1 != k0; --k1)
@@ -1626,7 +1785,7 @@ parse_function_type(const char* first, const char* last, C& db)
                     {
                         if (sig.size() > 1)
                             sig += ", ";
-                        sig += db.names[k].move_full();
+                        db.names[k].append_to(sig);
                     }
                     for (size_t k = k0; k < k1; ++k)
                         db.names.pop_back();
@@ -1882,7 +2041,7 @@ template <class C>
 const char*
 parse_type(const char* first, const char* last, C& db)
 {
-    if (first != last)
+    if (first != last && spend(db))
     {
         switch (*first)
         {
@@ -3287,7 +3446,7 @@ template <class C>
 const char*
 parse_expression(const char* first, const char* last, C& db)
 {
-    if (last - first >= 2)
+    if (last - first >= 2 && spend(db))
     {
         const char* t = first;
         bool parsed_gs = false;
@@ -3842,6 +4001,11 @@ parse_template_args(const char* first, const char* last, C& db)
             db.template_param.back().clear();
         const char* t = first+1;
         typename C::String args("<");
+        // The arguments of this list go at the end of
+        //   db.capture->last_template_args, after any that are already
+        //   there, replacing those of the lists nested in them.
+        const size_t n0 = db.capture ? db.capture->last_template_args.size() : 0;
+        size_t arg_count = 0;
         while (*t != 'E')
         {
             if (db.tag_templates)
@@ -3859,16 +4023,28 @@ parse_template_args(const char* first, const char* last, C& db)
                 for (size_t k = k0; k < k1; ++k)
                     db.template_param.back().back().push_back(db.names[k]);
             }
+            if (db.capture)
+                db.capture->last_template_args.resize(n0 + arg_count);
             for (size_t k = k0; k < k1; ++k)
             {
                 if (args.size() > 1)
                     args += ", ";
-                args += db.names[k].move_full();
+                if (db.capture)
+                {
+                    db.capture->last_template_args.push_back(db.names[k].full());
+                    ++arg_count;
+                }
+                db.names[k].append_to(args);
             }
             for (; k1 != k0; --k1)
                 db.names.pop_back();
             t = t1;
         }
+        if (db.capture)
+        {
+            db.capture->last_template_args_begin = n0;
+            db.capture->last_template_args_end = n0 + arg_count;
+        }
         first = t + 1;
         if (args.back() != '>')
             args += ">";
@@ -3931,6 +4107,7 @@ parse_nested_name(const char* first, const char* last, C& db,
         }
         bool pop_subs = false;
         bool component_ends_with_template_args = false;
+        name_parts parts = {0, 0, db.names.back().first.size()};
         while (*t0 != 'E')
         {
             component_ends_with_template_args = false;
@@ -3947,11 +4124,17 @@ parse_nested_name(const char* first, const char* last, C& db,
                     db.names.pop_back();
                     if (!db.names.back().first.empty())
                     {
-                        db.names.back().first += "::" + name;
+                        parts.scope_end = db.names.back().first.size();
+                        parts.base_begin = parts.scope_end + 2;
+                        db.names.back().first.append("::").append(name);
                         db.subs.push_back(typename C::sub_type(1, db.names.back(), db.names.get_allocator()));
                     }
                     else
-                        db.names.back().first = name;
+                    {
+                        parts = split_name(name);
+                        db.names.back().first = std::move(name);
+                    }
+                    parts.base_end = db.names.back().first.size();
                     pop_subs = true;
                     t0 = t1;
                 }
@@ -3965,9 +4148,17 @@ parse_nested_name(const char* first, const char* last, C& db,
                     auto name = db.names.back().move_full();
                     db.names.pop_back();
                     if (!db.names.back().first.empty())
-                        db.names.back().first += "::" + name;
+                    {
+                        parts.scope_end = db.names.back().first.size();
+                        parts.base_begin = parts.scope_end + 2;
+                        db.names.back().first.append("::").append(name);
+                    }
                     else
-                        db.names.back().first = name;
+                    {
+                        db.names.back().first = std::move(name);
+                        parts.scope_end = parts.base_begin = 0;
+                    }
+                    parts.base_end = db.names.back().first.size();
                     db.subs.push_back(typename C::sub_type(1, db.names.back(), db.names.get_allocator()));
                     pop_subs = true;
                     t0 = t1;
@@ -3984,9 +4175,17 @@ parse_nested_name(const char* first, const char* last, C& db,
                     auto name = db.names.back().move_full();
                     db.names.pop_back();
                     if (!db.names.back().first.empty())
-                        db.names.back().first += "::" + name;
+                    {
+                        parts.scope_end = db.names.back().first.size();
+                        parts.base_begin = parts.scope_end + 2;
+                        db.names.back().first.append("::").append(name);
+                    }
                     else
-                        db.names.back().first = name;
+                    {
+                        db.names.back().first = std::move(name);
+                        parts.scope_end = parts.base_begin = 0;
+                    }
+                    parts.base_end = db.names.back().first.size();
                     db.subs.push_back(typename C::sub_type(1, db.names.back(), db.names.get_allocator()));
                     pop_subs = true;
                     t0 = t1;
@@ -4020,9 +4219,17 @@ parse_nested_name(const char* first, const char* last, C& db,
                     auto name = db.names.back().move_full();
                     db.names.pop_back();
                     if (!db.names.back().first.empty())
-                        db.names.back().first += "::" + name;
+                    {
+                        parts.scope_end = db.names.back().first.size();
+                        parts.base_begin = parts.scope_end + 2;
+                        db.names.back().first.append("::").append(name);
+                    }
                     else
-                        db.names.back().first = name;
+                    {
+                        db.names.back().first = std::move(name);
+                        parts.scope_end = parts.base_begin = 0;
+                    }
+                    parts.base_end = db.names.back().first.size();
                     db.subs.push_back(typename C::sub_type(1, db.names.back(), db.names.get_allocator()));
                     pop_subs = true;
                     t0 = t1;
@@ -4033,6 +4240,7 @@ parse_nested_name(const char* first, const char* last, C& db,
         }
         first = t0 + 1;
         db.cv = cv;
+        db.parts = parts;
         if (pop_subs && !db.subs.empty())
             db.subs.pop_back();
         if (ends_with_template_args)
@@ -4078,6 +4286,23 @@ parse_discriminator(const char* first, const char* last)
     return first;
 }
 
+// Moves db.parts, which were found for name alone, to where name will be once
+//   it is appended, after a "::", to the name of the enclosing function.
+template <class C>
+void
+shift_name_parts(C& db, const typename C::String& name)
+{
+    const size_t offset = db.names.back().first.size() + 2;
+    if (db.parts.base_end > name.size())
+        db.parts.base_end = name.size();
+    if (db.parts.base_begin == 0)
+        db.parts.scope_end = offset - 2;
+    else
+        db.parts.scope_end += offset;
+    db.parts.base_begin += offset;
+    db.parts.base_end += offset;
+}
+
 // <local-name> := Z <function encoding> E <entity name> [<discriminator>]
 //              := Z <function encoding> E s [<discriminator>]
 //              := Z <function encoding> Ed [ <parameter number> ] _ <entity name>
@@ -4098,7 +4323,13 @@ parse_local_name(const char* first, const char* last, C& db,
                 first = parse_discriminator(t+1, last);
                 if (db.names.empty())
                     return first;
-                db.names.back().first.append("::string literal");
+                {
+                    const size_t scope_end = db.names.back().first.size();
+                    db.names.back().first.append("::string literal");
+                    db.parts.scope_end = scope_end;
+                    db.parts.base_begin = scope_end + 2;
+                    db.parts.base_end = db.names.back().first.size();
+                }
                 break;
             case 'd':
                 if (++t != last)
@@ -4115,6 +4346,7 @@ parse_local_name(const char* first, const char* last, C& db,
                                 return first;
                             auto name = db.names.back().move_full();
                             db.names.pop_back();
+                            shift_name_parts(db, name);
                             db.names.back().first.append("::");
                             db.names.back().first.append(name);
                             first = t1;
@@ -4136,6 +4368,7 @@ parse_local_name(const char* first, const char* last, C& db,
                             return first;
                         auto name = db.names.back().move_full();
                         db.names.pop_back();
+                        shift_name_parts(db, name);
                         db.names.back().first.append("::");
                         db.names.back().first.append(name);
                     }
@@ -4191,10 +4424,18 @@ parse_name(const char* first, const char* last, C& db,
             const char* t1 = parse_unscoped_name(t0, last, db);
             if (t1 != t0)
             {
+                if (db.names.empty())
+                    return first;
+                // parse_unscoped_name has put "std::" in front of the name
+                const typename C::String& nm = db.names.back().first;
+                name_parts parts = {0, 0, nm.size()};
+                if (nm.compare(0, 5, "std::") == 0)
+                {
+                    parts.scope_end = 3;
+                    parts.base_begin = 5;
+                }
                 if (t1 != last && *t1 == 'I')  // <unscoped-template-name> <template-args>
                 {
-                    if (db.names.empty())
-                        return first;
                     db.subs.push_back(typename C::sub_type(1, db.names.back(), db.names.get_allocator()));
                     t0 = t1;
                     t1 = parse_template_args(t0, last, db);
@@ -4206,18 +4447,25 @@ parse_name(const char* first, const char* last, C& db,
                         db.names.pop_back();
                         db.names.back().first += tmp;
                         first = t1;
+                        db.parts = parts;
                         if (ends_with_template_args)
                             *ends_with_template_args = true;
                     }
                 }
                 else   // <unscoped-name>
+                {
                     first = t1;
+                    db.parts = parts;
+                }
             }
             else
             {   // try <substitution> <template-args>
                 t1 = parse_substitution(t0, last, db);
                 if (t1 != t0 && t1 != last && *t1 == 'I')
                 {
+                    if (db.names.empty())
+                        return first;
+                    name_parts parts = split_name(db.names.back().first);
                     t0 = t1;
                     t1 = parse_template_args(t0, last, db);
                     if (t1 != t0)
@@ -4228,6 +4476,7 @@ parse_name(const char* first, const char* last, C& db,
                         db.names.pop_back();
                         db.names.back().first += tmp;
                         first = t1;
+                        db.parts = parts;
                         if (ends_with_template_args)
                             *ends_with_template_args = true;
                     }
@@ -4478,7 +4727,7 @@ template <class C>
 const char*
 parse_encoding(const char* first, const char* last, C& db)
 {
-    if (first != last)
+    if (first != last && spend(db))
     {
         save_value<decltype(db.encoding_depth)> su(db.encoding_depth);
         ++db.encoding_depth;
@@ -4494,10 +4743,34 @@ parse_encoding(const char* first, const char* last, C& db)
         default:
           {
             bool ends_with_template_args = false;
+            // Only the outermost encoding is broken into pieces
+            auto* capture = db.encoding_depth == 1 ? db.capture : nullptr;
+            if (capture)
+                db.parts.base_end = static_cast<size_t>(-1);
             const char* t = parse_name(first, last, db,
                                        &ends_with_template_args);
             unsigned cv = db.cv;
             unsigned ref = db.ref;
+            if (t != first && capture && !db.names.empty() &&
+                db.names.back().second.empty())
+            {
+                capture->kind = data_encoding;
+                capture->name = db.names.back().first;
+                capture->parts = db.parts;
+                if (db.parts.base_end > capture->name.size() ||
+                    db.parts.base_begin > db.parts.base_end ||
+                    db.parts.scope_end > db.parts.base_begin)
+                    capture->parts = split_name(capture->name);
+                capture->template_args.clear();
+                if (ends_with_template_args)
+                    capture->template_args.assign(
+                        capture->last_template_args.begin() +
+                            static_cast<std::ptrdiff_t>(
+                                capture->last_template_args_begin),
+                        capture->last_template_args.begin() +
+                            static_cast<std::ptrdiff_t>(
+                                capture->last_template_args_end));
+            }
             if (t != first)
             {
                 if (t != last && *t != 'E' && *t != '.')
@@ -4520,6 +4793,11 @@ parse_encoding(const char* first, const char* last, C& db)
                             return first;
                         auto ret1 = std::move(db.names.back().first);
                         ret2 = std::move(db.names.back().second);
+                        if (capture)
+                        {
+                            capture->return_type = ret1;
+                            capture->return_type_tail = ret2;
+                        }
                         if (ret2.empty())
                             ret1 += ' ';
                         db.names.pop_back();
@@ -4543,25 +4821,31 @@ parse_encoding(const char* first, const char* last, C& db)
                                 break;
                             if (k1 > k0)
                             {
-                                typename C::String tmp;
+                                if (k0 == 0)
+                                    return first;
+                                // The types go straight onto the name, and
+                                //   are taken off again if they are empty
+                                typename C::String& out = db.names[k0-1].first;
+                                const size_t mark = out.size();
+                                if (!first_arg)
+                                    out += ", ";
+                                const size_t begin = out.size();
                                 for (size_t k = k0; k < k1; ++k)
                                 {
-                                    if (!tmp.empty())
-                                        tmp += ", ";
-                                    tmp += db.names[k].move_full();
+                                    if (out.size() != begin)
+                                        out += ", ";
+                                    db.names[k].append_to(out);
                                 }
-                                for (size_t k = k0; k < k1; ++k)
-                                    db.names.pop_back();
-                                if (!tmp.empty())
+                                if (out.size() == begin)
+                                    out.resize(mark);
+                                else
                                 {
-                                    if (db.names.empty())
-                                        return first;
-                                    if (!first_arg)
-                                        db.names.back().first += ", ";
-                                    else
-                                        first_arg = false;
-                                    db.names.back().first += tmp;
+                                    first_arg = false;
+                                    if (capture)
+                                        capture->parameters.push_back(out.substr(begin));
                                 }
+                                for (size_t k = k0; k < k1; ++k)
+                                    db.names.pop_back();
                             }
                             t = t2;
                         }
@@ -4569,6 +4853,7 @@ parse_encoding(const char* first, const char* last, C& db)
                     if (db.names.empty())
                         return first;
                     db.names.back().first += ')';
+                    const size_t quals_begin = db.names.back().first.size();
                     if (cv & 1)
                         db.names.back().first.append(" const");
                     if (cv & 2)
@@ -4579,6 +4864,13 @@ parse_encoding(const char* first, const char* last, C& db)
                         db.names.back().first.append(" &");
                     else if (ref == 2)
                         db.names.back().first.append(" &&");
+                    if (capture && capture->kind == data_encoding)
+                    {
+                        capture->kind = function_encoding;
+                        capture->qualifiers.assign(db.names.back().first,
+                                                   quals_begin,
+                                                   C::String::npos);
+                    }
                     db.names.back().first += ret2;
                     first = t;
                 }
@@ -4702,6 +4994,233 @@ demangle(const char* first, const char* last, C& db, int& status)
         status = invalid_mangled_name;
 }
 
+// The memory that a demangler context keeps from one call to the next.
+//   Blocks are recycled through one free list per power of two size, so
+//   that once a context has demangled names of some length, more of them
+//   need no malloc.  Blocks that fit in a chunk are carved from chunks, and
+//   blocks of up to max_block_size bytes get a malloc of their own.  Both
+//   are only freed with the pool.  Larger blocks come straight from malloc.
+
+class demangle_pool
+{
+    static const std::size_t min_block_order = 4;
+    static const std::size_t max_block_order = 20;
+    static const std::size_t max_block_size = std::size_t(1) << max_block_order;
+    static const std::size_t chunk_order = 14;
+    static const std::size_t chunk_size = std::size_t(1) << chunk_order;
+
+    struct block
+    {
+        block* next;
+    };
+
+    // Each chunk starts with a pointer to the previous one
+    struct alignas(16) chunk_header
+    {
+        chunk_header* prev;
+    };
+
+    block* free_[max_block_order - min_block_order + 1];
+    chunk_header* chunks_;
+    char* ptr_;
+    char* end_;
+
+    static
+    std::size_t
+    order(std::size_t n) noexcept
+    {
+        std::size_t k = min_block_order;
+        while ((std::size_t(1) << k) < n)
+            ++k;
+        return k;
+    }
+
+public:
+    demangle_pool() noexcept : chunks_(nullptr), ptr_(nullptr), end_(nullptr)
+    {
+        for (std::size_t i = 0; i <= max_block_order - min_block_order; ++i)
+            free_[i] = nullptr;
+    }
+
+    ~demangle_pool()
+    {
+        for (std::size_t k = chunk_order + 1; k <= max_block_order; ++k)
+        {
+            while (block* b = free_[k - min_block_order])
+            {
+                free_[k - min_block_order] = b->next;
+                std::free(b);
+            }
+        }
+        while (chunks_ != nullptr)
+        {
+            chunk_header* prev = chunks_->prev;
+            std::free(chunks_);
+            chunks_ = prev;
+        }
+    }
+
+    demangle_pool(const demangle_pool&) = delete;
+    demangle_pool& operator=(const demangle_pool&) = delete;
+
+    void* allocate(std::size_t n) noexcept;
+    void deallocate(void* p, std::size_t n) noexcept;
+};
+
+void*
+demangle_pool::allocate(std::size_t n) noexcept
+{
+    if (n > max_block_size)
+        return std::malloc(n);
+    const std::size_t k = order(n);
+    block*& head = free_[k - min_block_order];
+    if (head != nullptr)
+    {
+        block* b = head;
+        head = b->next;
+        return b;
+    }
+    const std::size_t size = std::size_t(1) << k;
+    if (k > chunk_order)
+        return std::malloc(size);
+    if (static_cast<std::size_t>(end_ - ptr_) < size)
+    {
+        chunk_header* c = static_cast<chunk_header*>(
+            std::malloc(sizeof(chunk_header) + chunk_size));
+        if (c == nullptr)
+            return nullptr;
+        c->prev = chunks_;
+        chunks_ = c;
+        ptr_ = reinterpret_cast<char*>(c + 1);
+        end_ = ptr_ + chunk_size;
+    }
+    void* r = ptr_;
+    ptr_ += size;
+    return r;
+}
+
+void
+demangle_pool::deallocate(void* p, std::size_t n) noexcept
+{
+    if (p == nullptr)
+        return;
+    if (n > max_block_size)
+    {
+        std::free(p);
+        return;
+    }
+    block* b = static_cast<block*>(p);
+    block*& head = free_[order(n) - min_block_order];
+    b->next = head;
+    head = b;
+}
+
+// The pool of the context that the current thread is demangling with, if
+//   any.  Everything the demangler allocates goes through demangle_malloc
+//   and demangle_free, which use it instead of malloc.  They are kept out
+//   of line: inlined into every string operation, they make the demangler
+//   without a context a fifth slower.
+
+#if LIBCXXABI_HAS_NO_THREADS
+demangle_pool* current_pool = nullptr;
+#elif LIBCXXABI_HAS_TLS_EH_GLOBALS
+__thread demangle_pool* current_pool __attribute__((tls_model("initial-exec"))) = nullptr;
+#else
+__thread demangle_pool* current_pool = nullptr;
+#endif
+
+__attribute__((noinline))
+void*
+demangle_malloc(std::size_t n) noexcept
+{
+    if (current_pool != nullptr)
+        return current_pool->allocate(n);
+    return std::malloc(n);
+}
+
+__attribute__((noinline))
+void
+demangle_free(void* p, std::size_t n) noexcept
+{
+    if (current_pool != nullptr)
+        current_pool->deallocate(p, n);
+    else
+        std::free(p);
+}
+
+// Makes the demangler allocate from pool until the end of the scope, and
+//   then from whatever it allocated from before, so that a demangle nested
+//   in another one, from a callback say, leaves the outer one's pool alone.
+class pool_scope
+{
+    demangle_pool* previous_;
+public:
+    explicit pool_scope(demangle_pool* pool) noexcept
+        : previous_(current_pool) {current_pool = pool;}
+    ~pool_scope() {current_pool = previous_;}
+    pool_scope(const pool_scope&) = delete;
+    pool_scope& operator=(const pool_scope&) = delete;
+};
+
+// Fills in the forward references that parse_template_param left in name
+//   with the template arguments they refer to, as they are after the whole
+//   name has been parsed.  If there are none, the references are left as
+//   written, without their marks.  Returns false if filling them in might
+//   not give the same name as demangling it again with the arguments known:
+//   when an argument is a pack or has a second part, as function and array
+//   types do, or refers forward itself.
+
+template <class C>
+bool
+patch_forward_references(typename C::String& name, const C& db)
+{
+    typedef typename C::String String;
+    const bool have_args = !db.template_param.empty() &&
+                           !db.template_param.front().empty();
+    String patched;
+    size_t i = 0;
+    while (true)
+    {
+        size_t j = name.find(forward_reference_mark, i);
+        if (j == String::npos)
+        {
+            patched.append(name, i, String::npos);
+            break;
+        }
+        patched.append(name, i, j - i);
+        // T_ or T<n>_, which parse_template_param has checked
+        size_t k = j + 2;
+        size_t index = 0;
+        if (name[k] != '_')
+        {
+            for (; name[k] != '_'; ++k)
+                index = index * 10 + static_cast<size_t>(name[k] - '0');
+            ++index;
+        }
+        ++k;
+        if (!have_args)
+            patched.append(name, j + 1, k - (j + 1));
+        else
+        {
+            const auto& params = db.template_param.back();
+            if (index >= params.size() || params[index].size() != 1)
+                return false;
+            const auto& arg = params[index].front();
+            if (!arg.second.empty() ||
+                arg.first.find(forward_reference_mark) != String::npos)
+                return false;
+            patched += arg.first;
+            // parse_template_args closes a list that ends in '>' with " >"
+            if (k < name.size() && name[k] == '>' &&
+                !arg.first.empty() && arg.first.back() == '>')
+                patched += ' ';
+        }
+        i = k;
+    }
+    name = std::move(patched);
+    return true;
+}
+
 template <std::size_t N>
 class arena
 {
@@ -4742,21 +5261,21 @@ arena<N>::allocate(std::size_t n)
         ptr_ += n;
         return r;
     }
-    return static_cast<char*>(std::malloc(n));
+    return static_cast<char*>(demangle_malloc(n));
 }
 
 template <std::size_t N>
 void
 arena<N>::deallocate(char* p, std::size_t n) noexcept
 {
+    n = align_up(n);
     if (pointer_in_buffer(p))
     {
-        n = align_up(n);
         if (p + n == ptr_)
             ptr_ = p;
     }
     else
-        std::free(p);
+        demangle_free(p, n);
 }
 
 template <class T, std::size_t N>
@@ -4810,28 +5329,28 @@ operator!=(const short_alloc<T, N>& x, const short_alloc<U, M>& y) noexcept
 }
 
 template <class T>
-class malloc_alloc
+class pool_alloc
 {
 public:
     typedef T value_type;
 
-    malloc_alloc() = default;
-    template <class U> malloc_alloc(const malloc_alloc<U>&) noexcept {}
+    pool_alloc() = default;
+    template <class U> pool_alloc(const pool_alloc<U>&) noexcept {}
 
     T* allocate(std::size_t n)
     {
-        return static_cast<T*>(std::malloc(n*sizeof(T)));
+        return static_cast<T*>(demangle_malloc(n*sizeof(T)));
     }
-    void deallocate(T* p, std::size_t) noexcept
+    void deallocate(T* p, std::size_t n) noexcept
     {
-        std::free(p);
+        demangle_free(p, n*sizeof(T));
     }
 };
 
 template <class T, class U>
 inline
 bool
-operator==(const malloc_alloc<T>&, const malloc_alloc<U>&) noexcept
+operator==(const pool_alloc<T>&, const pool_alloc<U>&) noexcept
 {
     return true;
 }
@@ -4839,7 +5358,7 @@ operator==(const malloc_alloc<T>&, const malloc_alloc<U>&) noexcept
 template <class T, class U>
 inline
 bool
-operator!=(const malloc_alloc<T>& x, const malloc_alloc<U>& y) noexcept
+operator!=(const pool_alloc<T>& x, const pool_alloc<U>& y) noexcept
 {
     return !(x == y);
 }
@@ -4864,12 +5383,65 @@ struct string_pair
     size_t size() const {return first.size() + second.size();}
     StrT full() const {return first + second;}
     StrT move_full() {return std::move(first) + std::move(second);}
+    // Appends the whole name to s, without a temporary
+    void append_to(StrT& s) const {s.append(first).append(second);}
+};
+
+// The pieces of the outermost encoding of a mangled name, kept as they are
+//   parsed for __cxa_demangle_tree_create.  Apart from anything a block
+//   invocation or a dot suffix adds around it, the demangled name is
+//
+//     name                                                for a data name
+//     return_type + [' ' if return_type_tail is empty] + name +
+//         '(' + parameters, separated by ", " + ')' + qualifiers +
+//         return_type_tail                                for a function
+//
+//   and is only known as a whole for anything else.
+
+template <class String>
+struct encoding_capture
+{
+    typedef std::vector<String, pool_alloc<String>> strings;
+
+    encoding_kind kind;
+    String name;
+    name_parts parts;
+    strings template_args;
+    String return_type;
+    String return_type_tail;
+    strings parameters;
+    String qualifiers;
+    // The arguments of the template argument lists parsed so far, of which
+    //   the last list is [last_template_args_begin, last_template_args_end)
+    strings last_template_args;
+    size_t last_template_args_begin;
+    size_t last_template_args_end;
+
+    encoding_capture()
+        : kind(other_encoding),
+          last_template_args_begin(0),
+          last_template_args_end(0)
+    {}
+
+    void clear()
+    {
+        kind = other_encoding;
+        name.clear();
+        template_args.clear();
+        return_type.clear();
+        return_type_tail.clear();
+        parameters.clear();
+        qualifiers.clear();
+        last_template_args.clear();
+        last_template_args_begin = 0;
+        last_template_args_end = 0;
+    }
 };
 
 struct Db
 {
     typedef std::basic_string<char, std::char_traits<char>,
-                              malloc_alloc<char>> String;
+                              pool_alloc<char>> String;
     typedef Vector<string_pair<String>> sub_type;
     typedef Vector<sub_type> template_param_type;
     sub_type names;
@@ -4881,42 +5453,73 @@ struct Db
     bool parsed_ctor_dtor_cv;
     bool tag_templates;
     bool fix_forward_references;
+    bool mark_forward_references;
     bool try_to_parse_template_args;
+    name_parts parts;
+    // Null unless the caller wants the pieces of the name
+    encoding_capture<String>* capture;
+    // The budget, if limited (see spend)
+    bool limited;
+    bool over_budget;
+    size_t steps_left;
+    size_t max_length;
+    String truncated;
 
     template <size_t N>
     Db(arena<N>& ar) :
         names(ar),
         subs(0, names, ar),
-        template_param(0, subs, ar)
+        template_param(0, subs, ar),
+        capture(nullptr),
+        limited(false),
+        over_budget(false),
+        steps_left(0),
+        max_length(0)
     {}
 };
 
-}  // unnamed namespace
+// Fills in the forward references in the pieces of capture, keeping
+//   capture.parts in step with the name.
+bool
+patch_capture(encoding_capture<Db::String>& capture, const Db& db)
+{
+    typedef Db::String String;
+    if (capture.kind == other_encoding)
+        return true;
+    const name_parts parts = capture.parts;
+    String scope(capture.name, 0, parts.scope_end);
+    String base(capture.name, parts.base_begin, parts.base_end - parts.base_begin);
+    String rest(capture.name, parts.base_end, String::npos);
+    if (!patch_forward_references(scope, db) ||
+        !patch_forward_references(base, db) ||
+        !patch_forward_references(rest, db) ||
+        !patch_forward_references(capture.return_type, db) ||
+        !patch_forward_references(capture.return_type_tail, db))
+        return false;
+    for (auto& arg : capture.template_args)
+        if (!patch_forward_references(arg, db))
+            return false;
+    for (auto& param : capture.parameters)
+        if (!patch_forward_references(param, db))
+            return false;
+    String name(scope);
+    name.append(capture.name, parts.scope_end, parts.base_begin - parts.scope_end);
+    capture.parts.scope_end = scope.size();
+    capture.parts.base_begin = name.size();
+    name += base;
+    capture.parts.base_end = name.size();
+    name += rest;
+    capture.name = std::move(name);
+    return true;
+}
 
-extern "C"
-__attribute__ ((__visibility__("default")))
-char*
-__cxa_demangle(const char* mangled_name, char* buf, size_t* n, int* status)
+// Demangles mangled_name into db.names.back(), with db and its arena a
+//   fresh, and returns the status.  The name is left in two parts, to be
+//   copied out one after the other.  If db.capture is set, it is left
+//   holding the pieces of the name.
+int
+run_demangler(const char* mangled_name, arena<bs>& a, Db& db)
 {
-    if (mangled_name == nullptr || (buf != nullptr && n == nullptr))
-    {
-        if (status)
-            *status = invalid_args;
-        return nullptr;
-    }
-    // @LOCALMOD-START The demangler is *huge* and only used in
-    // default_terminate_handler with a fallback to printing mangled
-    // names instead. pexe size matters a lot, so PNaCl only prints out
-    // mangled names when exceptions are uncaught.
-#ifdef __pnacl__
-    if (status)
-        *status = memory_alloc_failure;
-    return nullptr;
-#else
-    // @LOCALMOD-END
-    size_t internal_size = buf != nullptr ? *n : 0;
-    arena<bs> a;
-    Db db(a);
     db.cv = 0;
     db.ref = 0;
     db.encoding_depth = 0;
@@ -4927,52 +5530,566 @@ __cxa_demangle(const char* mangled_name, char* buf, size_t* n, int* status)
     db.try_to_parse_template_args = true;
     int internal_status = success;
     size_t len = std::strlen(mangled_name);
+    db.mark_forward_references =
+        std::memchr(mangled_name, forward_reference_mark, len) == nullptr;
     demangle(mangled_name, mangled_name + len, db,
              internal_status);
-    if (internal_status == success && db.fix_forward_references &&
-           !db.template_param.empty() && !db.template_param.front().empty())
+    if (db.over_budget)
+        return budget_exceeded;
+    if (internal_status != success || !db.fix_forward_references)
+        return internal_status;
+    db.names.back().first += db.names.back().second;
+    db.names.back().second.clear();
+    if (!db.mark_forward_references ||
+        !patch_forward_references(db.names.back().first, db) ||
+        (db.capture && !patch_capture(*db.capture, db)))
     {
+        // Demangle again with the template arguments known.  Those kept
+        //   from the first pass are copied in for T_ and T<n>_, so any
+        //   references they make forward are left as written.
         db.fix_forward_references = false;
         db.tag_templates = false;
         db.names.clear();
         db.subs.clear();
+        if (db.capture)
+            db.capture->clear();
+        if (db.mark_forward_references)
+        {
+            for (auto& level : db.template_param)
+                for (auto& arg : level)
+                    for (auto& name : arg)
+                    {
+                        erase_forward_reference_marks(name.first);
+                        erase_forward_reference_marks(name.second);
+                    }
+            db.mark_forward_references = false;
+        }
         demangle(mangled_name, mangled_name + len, db, internal_status);
+        if (db.over_budget)
+            return budget_exceeded;
         if (db.fix_forward_references)
             internal_status = invalid_mangled_name;
     }
+    return internal_status;
+}
+
+// The limits of __cxa_demangle_bounded, either of which may be 0 for none
+struct demangle_budget
+{
+    size_t max_length;
+    size_t max_steps;
+};
+
+// Demangles mangled_name into buf at offset, followed by a null.  buf holds
+//   capacity bytes, and is grown with realloc if the name does not fit, in
+//   which case buf and capacity are updated.  length is set to the length of
+//   the demangled name.  The two parts of the name are copied straight into
+//   buf, never joined.  If there is a budget and it runs out, what there is
+//   of the name is written, followed by "...", and budget_exceeded is
+//   returned.  On any other failure nothing is written.
+int
+demangle_to_buffer(const char* mangled_name, char*& buf, size_t& capacity,
+                   size_t offset, size_t& length,
+                   const demangle_budget* budget = nullptr)
+{
+    // @LOCALMOD-START The demangler is *huge* and only used in
+    // default_terminate_handler with a fallback to printing mangled
+    // names instead. pexe size matters a lot, so PNaCl only prints out
+    // mangled names when exceptions are uncaught.
+#ifdef __pnacl__
+    return memory_alloc_failure;
+#else
+    // @LOCALMOD-END
+    arena<bs> a;
+    Db db(a);
+    if (budget != nullptr)
+    {
+        db.limited = true;
+        db.max_length = budget->max_length;
+        db.steps_left = budget->max_steps != 0 ? budget->max_steps
+                                               : static_cast<size_t>(-1);
+    }
+    int internal_status = run_demangler(mangled_name, a, db);
+    if (internal_status != success && internal_status != budget_exceeded)
+        return internal_status;
+    const char* first = db.truncated.data();
+    size_t first_size = db.truncated.size();
+    const char* second = "";
+    size_t second_size = 0;
     if (internal_status == success)
     {
-        size_t sz = db.names.back().size() + 1;
-        if (sz > internal_size)
-        {
-            char* newbuf = static_cast<char*>(std::realloc(buf, sz));
-            if (newbuf == nullptr)
-            {
-                internal_status = memory_alloc_failure;
-                buf = nullptr;
-            }
-            else
-            {
-                buf = newbuf;
-                if (n != nullptr)
-                    *n = sz;
-            }
-        }
-        if (buf != nullptr)
+        const auto& name = db.names.back();
+        first = name.first.data();
+        first_size = name.first.size();
+        second = name.second.data();
+        second_size = name.second.size();
+        if (db.max_length != 0 && name.size() > db.max_length)
+            internal_status = budget_exceeded;
+    }
+    size_t dots = 0;
+    if (internal_status == budget_exceeded)
+    {
+        // Cut the name short to leave room for the dots
+        dots = db.max_length != 0 && db.max_length < 3 ? db.max_length : 3;
+        if (db.max_length != 0)
         {
-            db.names.back().first += db.names.back().second;
-            std::memcpy(buf, db.names.back().first.data(), sz-1);
-            buf[sz-1] = char(0);
+            const size_t keep = db.max_length - dots;
+            if (first_size > keep)
+                first_size = keep;
+            if (second_size > keep - first_size)
+                second_size = keep - first_size;
         }
     }
+    size_t sz = first_size + second_size + dots + 1;
+    if (offset + sz > capacity)
+    {
+        char* newbuf = static_cast<char*>(std::realloc(buf, offset + sz));
+        if (newbuf == nullptr)
+            return memory_alloc_failure;
+        buf = newbuf;
+        capacity = offset + sz;
+    }
+    char* p = buf + offset;
+    std::memcpy(p, first, first_size);
+    p += first_size;
+    std::memcpy(p, second, second_size);
+    p += second_size;
+    std::memset(p, '.', dots);
+    p[dots] = char(0);
+    length = sz-1;
+    return internal_status;
+    // @LOCALMOD-START
+#endif // __pnacl__
+    // @LOCALMOD-END
+}
+
+}  // unnamed namespace
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+char*
+__cxa_demangle(const char* mangled_name, char* buf, size_t* n, int* status)
+{
+    if (mangled_name == nullptr || (buf != nullptr && n == nullptr))
+    {
+        if (status)
+            *status = invalid_args;
+        return nullptr;
+    }
+    size_t capacity = buf != nullptr ? *n : 0;
+    size_t length;
+    int internal_status = demangle_to_buffer(mangled_name, buf, capacity, 0, length);
+    if (internal_status == success)
+    {
+        if (n != nullptr && capacity != *n)
+            *n = capacity;
+    }
     else
         buf = nullptr;
     if (status)
         *status = internal_status;
     return buf;
+}
+
+// A demangler context is just the memory it keeps between calls.
+struct __cxa_demangle_context
+{
+    demangle_pool pool;
+};
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+__cxa_demangle_context*
+__cxa_demangle_context_create()
+{
+    void* p = std::malloc(sizeof(__cxa_demangle_context));
+    if (p == nullptr)
+        return nullptr;
+    return new (p) __cxa_demangle_context;
+}
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+void
+__cxa_demangle_context_destroy(__cxa_demangle_context* context)
+{
+    if (context == nullptr)
+        return;
+    context->~__cxa_demangle_context();
+    std::free(context);
+}
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+char*
+__cxa_demangle_with_context(__cxa_demangle_context* context,
+                            const char* mangled_name, char* buf, size_t* n,
+                            int* status)
+{
+    if (context == nullptr)
+    {
+        if (status)
+            *status = invalid_args;
+        return nullptr;
+    }
+    pool_scope scope(&context->pool);
+    return __cxa_demangle(mangled_name, buf, n, status);
+}
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+char*
+__cxa_demangle_bounded(__cxa_demangle_context* context,
+                       const char* mangled_name, char* buf, size_t* n,
+                       int* status, size_t max_length, size_t max_steps)
+{
+    if (mangled_name == nullptr || (buf != nullptr && n == nullptr))
+    {
+        if (status)
+            *status = invalid_args;
+        return nullptr;
+    }
+    pool_scope scope(context != nullptr ? &context->pool : nullptr);
+    demangle_budget budget = {max_length, max_steps};
+    size_t capacity = buf != nullptr ? *n : 0;
+    size_t length;
+    int internal_status = demangle_to_buffer(mangled_name, buf, capacity, 0,
+                                             length, &budget);
+    if (internal_status == success || internal_status == budget_exceeded)
+    {
+        if (n != nullptr && capacity != *n)
+            *n = capacity;
+    }
+    else
+        buf = nullptr;
+    if (status)
+        *status = internal_status;
+    return buf;
+}
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+char*
+__cxa_demangle_batch(__cxa_demangle_context* context,
+                     const char* const* mangled_names, size_t count,
+                     char* buf, size_t* n, size_t* offsets, int* statuses)
+{
+    if (context == nullptr || (mangled_names == nullptr && count != 0) ||
+        (buf != nullptr && n == nullptr) || (offsets == nullptr && count != 0))
+    {
+        for (size_t i = 0; statuses != nullptr && i < count; ++i)
+            statuses[i] = invalid_args;
+        return nullptr;
+    }
+    pool_scope scope(&context->pool);
+    size_t capacity = buf != nullptr ? *n : 0;
+    size_t used = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        int internal_status = invalid_args;
+        size_t length = 0;
+        if (mangled_names[i] != nullptr)
+            internal_status = demangle_to_buffer(mangled_names[i], buf, capacity,
+                                                 used, length);
+        if (internal_status == success)
+        {
+            offsets[i] = used;
+            used += length + 1;
+        }
+        else
+            offsets[i] = static_cast<size_t>(-1);
+        if (statuses != nullptr)
+            statuses[i] = internal_status;
+    }
+    if (n != nullptr)
+        *n = capacity;
+    return buf;
+}
+
+// A tree is allocated as one block: this header, then the nodes, then their
+//   text.  The whole name, which the demangler builds anyway, is kept in the
+//   text too, so that __cxa_demangle_tree_string has nothing left to do.
+struct __cxa_demangle_tree
+{
+    const __cxa_demangle_node* root;
+    const char* string;
+};
+
+namespace
+{
+
+// Hands out the nodes and text of a tree from its block, in order.
+class tree_writer
+{
+    __cxa_demangle_node* node_;
+    char* text_;
+public:
+    tree_writer(__cxa_demangle_node* node, char* text)
+        : node_(node), text_(text) {}
+
+    __cxa_demangle_node* nodes(size_t n)
+    {
+        __cxa_demangle_node* r = node_;
+        node_ += n;
+        return r;
+    }
+
+    const char* text(const char* s, size_t n)
+    {
+        char* r = text_;
+        std::memcpy(r, s, n);
+        r[n] = char(0);
+        text_ += n + 1;
+        return r;
+    }
+    template <class String>
+        const char* text(const String& s) {return text(s.data(), s.size());}
+
+    template <class String>
+    const char* text(const string_pair<String>& s)
+    {
+        char* r = text_;
+        std::memcpy(r, s.first.data(), s.first.size());
+        std::memcpy(r + s.first.size(), s.second.data(), s.second.size());
+        r[s.size()] = char(0);
+        text_ += s.size() + 1;
+        return r;
+    }
+
+    void set(__cxa_demangle_node& node, int kind, const char* text,
+             size_t child_count = 0, const __cxa_demangle_node* children = nullptr)
+    {
+        node.kind = kind;
+        node.text = text;
+        node.child_count = child_count;
+        node.children = children;
+    }
+};
+
+typedef encoding_capture<Db::String> capture_type;
+
+// These and the has_ flags of build_tree are 1 or 0, so that they can be
+//   added up to count nodes.
+
+size_t
+has_scope(const capture_type& c)
+{
+    return c.parts.scope_end > 0;
+}
+
+size_t
+has_template_args(const capture_type& c)
+{
+    return c.parts.base_end < c.name.size();
+}
+
+// The nodes and text below the name node
+void
+count_name(const capture_type& c, size_t& nodes, size_t& text)
+{
+    nodes += 1 + has_scope(c);
+    text += c.name.size() + 1 + c.parts.base_end - c.parts.base_begin + 1;
+    if (has_scope(c))
+        text += c.parts.scope_end + 1;
+    if (has_template_args(c))
+    {
+        nodes += 1 + c.template_args.size();
+        text += c.name.size() - c.parts.base_end + 1;
+        for (const auto& arg : c.template_args)
+            text += arg.size() + 1;
+    }
+}
+
+void
+write_name(const capture_type& c, __cxa_demangle_node& node, tree_writer& w)
+{
+    const size_t n = has_scope(c) + 1 + has_template_args(c);
+    __cxa_demangle_node* children = w.nodes(n);
+    w.set(node, __cxa_demangle_node_name, w.text(c.name), n, children);
+    if (has_scope(c))
+        w.set(*children++, __cxa_demangle_node_scope,
+              w.text(c.name.data(), c.parts.scope_end));
+    w.set(*children++, __cxa_demangle_node_base_name,
+          w.text(c.name.data() + c.parts.base_begin,
+                 c.parts.base_end - c.parts.base_begin));
+    if (has_template_args(c))
+    {
+        __cxa_demangle_node* args = w.nodes(c.template_args.size());
+        w.set(*children, __cxa_demangle_node_template_args,
+              w.text(c.name.data() + c.parts.base_end,
+                     c.name.size() - c.parts.base_end),
+              c.template_args.size(), args);
+        for (const auto& arg : c.template_args)
+            w.set(*args++, __cxa_demangle_node_template_arg, w.text(arg));
+    }
+}
+
+// Lays out the tree for the name demangled as whole, of which c holds the
+//   pieces.
+__cxa_demangle_tree*
+build_tree(const capture_type& c, const string_pair<Db::String>& whole)
+{
+    const size_t has_return_type = !c.return_type.empty() ||
+                                   !c.return_type_tail.empty();
+    const size_t has_qualifiers = !c.qualifiers.empty();
+    size_t params_size = 2;
+    for (const auto& param : c.parameters)
+        params_size += param.size();
+    if (c.parameters.size() > 1)
+        params_size += 2 * (c.parameters.size() - 1);
+    size_t nodes = 1;
+    size_t text = whole.size() + 1;
+    switch (c.kind)
+    {
+    case function_encoding:
+        nodes += has_return_type + 1 + 1 + has_qualifiers + c.parameters.size();
+        if (has_return_type)
+            text += c.return_type.size() + c.return_type_tail.size() + 1;
+        text += params_size + 1;
+        for (const auto& param : c.parameters)
+            text += param.size() + 1;
+        if (has_qualifiers)
+            text += c.qualifiers.size();
+        count_name(c, nodes, text);
+        break;
+    case data_encoding:
+        count_name(c, nodes, text);
+        break;
+    case other_encoding:
+        break;
+    }
+    const size_t size = sizeof(__cxa_demangle_tree) +
+                        nodes * sizeof(__cxa_demangle_node) + text;
+    char* block = static_cast<char*>(std::malloc(size));
+    if (block == nullptr)
+        return nullptr;
+    __cxa_demangle_tree* tree = reinterpret_cast<__cxa_demangle_tree*>(block);
+    __cxa_demangle_node* node_block =
+        reinterpret_cast<__cxa_demangle_node*>(tree + 1);
+    tree_writer w(node_block, reinterpret_cast<char*>(node_block + nodes));
+    __cxa_demangle_node* root = w.nodes(1);
+    tree->root = root;
+    tree->string = w.text(whole);
+    switch (c.kind)
+    {
+    case function_encoding:
+      {
+        const size_t n = has_return_type + 2 + has_qualifiers;
+        __cxa_demangle_node* children = w.nodes(n);
+        w.set(*root, __cxa_demangle_node_function, nullptr, n, children);
+        if (has_return_type)
+            w.set(*children++, __cxa_demangle_node_return_type,
+                  w.text(c.return_type + c.return_type_tail));
+        write_name(c, *children++, w);
+        Db::String params("(");
+        for (const auto& param : c.parameters)
+        {
+            if (params.size() > 1)
+                params += ", ";
+            params += param;
+        }
+        params += ')';
+        __cxa_demangle_node* param_nodes = w.nodes(c.parameters.size());
+        w.set(*children++, __cxa_demangle_node_parameters, w.text(params),
+              c.parameters.size(), param_nodes);
+        for (const auto& param : c.parameters)
+            w.set(*param_nodes++, __cxa_demangle_node_parameter, w.text(param));
+        // The qualifiers are kept without the space in front of them
+        if (has_qualifiers)
+            w.set(*children, __cxa_demangle_node_qualifiers,
+                  w.text(c.qualifiers.data() + 1, c.qualifiers.size() - 1));
+        break;
+      }
+    case data_encoding:
+        write_name(c, *root, w);
+        break;
+    case other_encoding:
+        w.set(*root, __cxa_demangle_node_other, tree->string);
+        break;
+    }
+    return tree;
+}
+
+}  // unnamed namespace
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+__cxa_demangle_tree*
+__cxa_demangle_tree_create(__cxa_demangle_context* context,
+                           const char* mangled_name, int* status)
+{
+    if (mangled_name == nullptr)
+    {
+        if (status)
+            *status = invalid_args;
+        return nullptr;
+    }
+    // @LOCALMOD-START See demangle_to_buffer
+#ifdef __pnacl__
+    if (status)
+        *status = memory_alloc_failure;
+    return nullptr;
+#else
+    // @LOCALMOD-END
+    // Everything that uses the pool has to be gone before the scope ends
+    pool_scope scope(context != nullptr ? &context->pool : nullptr);
+    __cxa_demangle_tree* tree = nullptr;
+    {
+        arena<bs> a;
+        Db db(a);
+        capture_type capture;
+        db.capture = &capture;
+        int internal_status = run_demangler(mangled_name, a, db);
+        if (internal_status == success)
+        {
+            tree = build_tree(capture, db.names.back());
+            if (tree == nullptr)
+                internal_status = memory_alloc_failure;
+        }
+        if (status)
+            *status = internal_status;
+    }
+    return tree;
     // @LOCALMOD-START
 #endif // __pnacl__
     // @LOCALMOD-END
 }
 
+extern "C"
+__attribute__ ((__visibility__("default")))
+void
+__cxa_demangle_tree_destroy(__cxa_demangle_tree* tree)
+{
+    std::free(tree);
+}
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+const __cxa_demangle_node*
+__cxa_demangle_tree_root(const __cxa_demangle_tree* tree)
+{
+    return tree != nullptr ? tree->root : nullptr;
+}
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+const __cxa_demangle_node*
+__cxa_demangle_node_child(const __cxa_demangle_node* node, int kind)
+{
+    if (node == nullptr)
+        return nullptr;
+    for (size_t i = 0; i < node->child_count; ++i)
+        if (node->children[i].kind == kind)
+            return &node->children[i];
+    return nullptr;
+}
+
+extern "C"
+__attribute__ ((__visibility__("default")))
+const char*
+__cxa_demangle_tree_string(__cxa_demangle_tree* tree)
+{
+    return tree != nullptr ? tree->string : nullptr;
+}
+
 }  // __cxxabiv1
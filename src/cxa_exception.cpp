@@ -23,16 +23,19 @@
 #include "cxa_exception.hpp"
 #include "cxa_handlers.hpp"
 
-// +---------------------------+-----------------------------+---------------+
-// | __cxa_exception           | _Unwind_Exception CLNGC++\0 | thrown object |
-// +---------------------------+-----------------------------+---------------+
-//                                                           ^
-//                                                           |
-//   +-------------------------------------------------------+
-//   |
-// +---------------------------+-----------------------------+
-// | __cxa_dependent_exception | _Unwind_Exception CLNGC++\1 |
-// +---------------------------+-----------------------------+
+// +--------------+---------------------------+-----------------------------+---------------+
+// | block header | __cxa_exception           | _Unwind_Exception CLNGC++\0 | thrown object |
+// +--------------+---------------------------+-----------------------------+---------------+
+//                                                                          ^
+//                                                                          |
+//                  +-------------------------------------------------------+
+//                  |
+// +--------------+---------------------------+-----------------------------+
+// | block header | __cxa_dependent_exception | _Unwind_Exception CLNGC++\1 |
+// +--------------+---------------------------+-----------------------------+
+//
+// The block header is private to this file and records which size class of
+// the per-thread exception cache the block belongs to.
 
 namespace __cxxabiv1 {
 
@@ -106,18 +109,146 @@ static inline  int decrementHandlerCount(__cxa_exception *exception) {
 
 #include "fallback_malloc.ipp"
 
-//  Allocate some memory from _somewhere_
-static void *do_malloc(size_t size) {
-    void *ptr = std::malloc(size);
-    if (NULL == ptr) // if malloc fails, fall back to emergency stash
-        ptr = fallback_malloc(size);
-    return ptr;
-}
-
 static void do_free(void *ptr) {
     is_fallback_ptr(ptr) ? fallback_free(ptr) : std::free(ptr);
 }
 
+//  Prepended to every exception block.  It is as aligned as _Unwind_Exception
+//  so that the exception header behind it stays suitably aligned.
+struct __attribute__((aligned)) exception_block_header {
+    size_t size_class;
+};
+
+//  Returns the cache size class for a block of size bytes, including its
+//  header, or kExceptionCacheClasses if it is too big to be cached.
+static size_t exception_size_class(size_t size) {
+    size_t block_size = kExceptionCacheMinBlock;
+    for (size_t size_class = 0; size_class < kExceptionCacheClasses; ++size_class) {
+        if (size <= block_size)
+            return size_class;
+        block_size *= 2;
+    }
+    return kExceptionCacheClasses;
+}
+
+//  Allocate an exception block with room for size bytes, preferring a block
+//  this thread has freed before.  Cacheable blocks from malloc are allocated
+//  at the full size of their class so that any block of the class can be
+//  reused.  Blocks from the emergency pool are never cached, so they are
+//  only as big as they need to be.
+static void *allocate_exception_block(size_t size) {
+    size_t actual_size = size + sizeof(exception_block_header);
+    size_t size_class = exception_size_class(actual_size);
+    exception_block_header *header = NULL;
+    if (size_class < kExceptionCacheClasses) {
+        __cxa_eh_globals *globals = __get_eh_globals_fast();
+        if (NULL != globals && NULL != globals->exceptionCache[size_class]) {
+            void *block = globals->exceptionCache[size_class];
+            globals->exceptionCache[size_class] = *static_cast<void **>(block);
+            --globals->exceptionCacheCount[size_class];
+            header = static_cast<exception_block_header *>(block);
+        }
+    }
+    if (NULL == header) {
+        void *block = std::malloc(size_class < kExceptionCacheClasses
+                                      ? kExceptionCacheMinBlock << size_class
+                                      : actual_size);
+        if (NULL == block)
+            block = fallback_malloc(actual_size);
+        header = static_cast<exception_block_header *>(block);
+    }
+    if (NULL == header)
+        return NULL;
+    header->size_class = size_class;
+    return header + 1;
+}
+
+//  The blocks reserved for out-of-memory exceptions.  They are shared by all
+//  threads rather than kept per thread since an exception_ptr can keep one
+//  alive after the thread that threw it has exited.  A block is claimed and
+//  released with a single atomic operation on its in-use flag.
+static const size_t reserved_size_class = kExceptionCacheClasses + 1;
+static char reserved_exception_blocks[kReservedExceptions][kReservedExceptionBlock]
+    __attribute__((aligned));
+static bool reserved_exception_in_use[kReservedExceptions];
+
+static bool is_reserved_exception_block(exception_block_header *header) {
+    return header->size_class == reserved_size_class;
+}
+
+static void free_reserved_exception_block(exception_block_header *header) {
+    size_t slot = static_cast<size_t>(reinterpret_cast<char *>(header) -
+                                      reserved_exception_blocks[0]) /
+                  kReservedExceptionBlock;
+    __atomic_store_n(&reserved_exception_in_use[slot], false, __ATOMIC_RELEASE);
+}
+
+//  Free an exception block, keeping it in this thread's cache if there is
+//  room.  Blocks from the emergency pool always go straight back to it, as
+//  does every block once the thread has released its cache on the way out,
+//  since nothing would release it again.
+static void free_exception_block(void *ptr) {
+    exception_block_header *header = static_cast<exception_block_header *>(ptr) - 1;
+    if (is_reserved_exception_block(header)) {
+        free_reserved_exception_block(header);
+        return;
+    }
+    size_t size_class = header->size_class;
+    if (size_class < kExceptionCacheClasses && !is_fallback_ptr(header)) {
+        __cxa_eh_globals *globals = __get_eh_globals_fast();
+        if (NULL != globals && !globals->exceptionCacheReleased &&
+            globals->exceptionCacheCount[size_class] < kExceptionCacheDepth) {
+            if (!globals->exceptionCacheRegistered) {
+                __register_exception_cache(globals);
+                globals->exceptionCacheRegistered = true;
+            }
+            void *block = header;
+            *static_cast<void **>(block) = globals->exceptionCache[size_class];
+            globals->exceptionCache[size_class] = block;
+            ++globals->exceptionCacheCount[size_class];
+            return;
+        }
+    }
+    do_free(header);
+}
+
+#pragma GCC visibility push(hidden)
+
+void * __cxa_allocate_reserved_exception(size_t thrown_size) throw() {
+    size_t actual_size = cxa_exception_size_from_exception_thrown_size(thrown_size);
+    if (actual_size + sizeof(exception_block_header) <= kReservedExceptionBlock) {
+        // Start at a different block on each thread so that threads running
+        // out of memory together rarely contend for the same one.
+        size_t first = reinterpret_cast<uintptr_t>(&actual_size) / 4096;
+        for (size_t i = 0; i < kReservedExceptions; ++i) {
+            size_t slot = (first + i) % kReservedExceptions;
+            if (__atomic_exchange_n(&reserved_exception_in_use[slot], true, __ATOMIC_ACQUIRE))
+                continue;
+            exception_block_header *header =
+                reinterpret_cast<exception_block_header *>(reserved_exception_blocks[slot]);
+            header->size_class = reserved_size_class;
+            __cxa_exception *exception_header = reinterpret_cast<__cxa_exception *>(header + 1);
+            std::memset(exception_header, 0, actual_size);
+            return thrown_object_from_cxa_exception(exception_header);
+        }
+    }
+    return __cxa_allocate_exception(thrown_size);
+}
+
+void __release_exception_cache(__cxa_eh_globals *globals) {
+    for (size_t size_class = 0; size_class < kExceptionCacheClasses; ++size_class) {
+        while (NULL != globals->exceptionCache[size_class]) {
+            void *block = globals->exceptionCache[size_class];
+            globals->exceptionCache[size_class] = *static_cast<void **>(block);
+            do_free(block);
+        }
+        globals->exceptionCacheCount[size_class] = 0;
+    }
+    globals->exceptionCacheReleased = true;
+}
+
+#pragma GCC visibility pop
+
 /*
     If reason isn't _URC_FOREIGN_EXCEPTION_CAUGHT, then the terminateHandler
     stored in exc is called.  Otherwise the exceptionDestructor stored in 
@@ -158,7 +289,7 @@ extern "C" {
 //  user's exception object.
 void * __cxa_allocate_exception (size_t thrown_size) throw() {
     size_t actual_size = cxa_exception_size_from_exception_thrown_size(thrown_size);
-    __cxa_exception* exception_header = static_cast<__cxa_exception*>(do_malloc(actual_size));
+    __cxa_exception* exception_header = static_cast<__cxa_exception*>(allocate_exception_block(actual_size));
     if (NULL == exception_header)
         std::terminate();
     std::memset(exception_header, 0, actual_size);
@@ -168,7 +299,7 @@ void * __cxa_allocate_exception (size_t thrown_size) throw() {
 
 //  Free a __cxa_exception object allocated with __cxa_allocate_exception.
 void __cxa_free_exception (void * thrown_object) throw() {
-    do_free(cxa_exception_from_thrown_object(thrown_object));
+    free_exception_block(cxa_exception_from_thrown_object(thrown_object));
 }
 
 
@@ -177,7 +308,7 @@ void __cxa_free_exception (void * thrown_object) throw() {
 //  Otherwise, it will work like __cxa_allocate_exception.
 void * __cxa_allocate_dependent_exception () {
     size_t actual_size = sizeof(__cxa_dependent_exception);
-    void *ptr = do_malloc(actual_size);
+    void *ptr = allocate_exception_block(actual_size);
     if (NULL == ptr)
         std::terminate();
     std::memset(ptr, 0, actual_size);
@@ -188,7 +319,29 @@ void * __cxa_allocate_dependent_exception () {
 //  This function shall free a dependent_exception.
 //  It does not affect the reference count of the primary exception.
 void __cxa_free_dependent_exception (void * dependent_exception) {
-    do_free(dependent_exception);
+    free_exception_block(dependent_exception);
+}
+
+
+//  Fill in the header of an exception allocated with __cxa_allocate_exception
+//  whose object has already been constructed, without throwing it.  This is
+//  what __cxa_throw does before raising the exception, and is enough for
+//  std::make_exception_ptr to wrap the object: the caller takes the first
+//  reference with __cxa_increment_exception_refcount, and the exception can
+//  later be thrown with __cxa_rethrow_primary_exception.
+__cxa_exception*
+__cxa_init_primary_exception(void* object, std::type_info* tinfo, void (*dest)(void*)) throw()
+{
+    __cxa_exception* exception_header = cxa_exception_from_thrown_object(object);
+
+    exception_header->referenceCount = 0;
+    exception_header->unexpectedHandler = std::get_unexpected();
+    exception_header->terminateHandler  = std::get_terminate();
+    exception_header->exceptionType = tinfo;
+    exception_header->exceptionDestructor = dest;
+    setExceptionClass(&exception_header->unwindHeader);
+    exception_header->unwindHeader.exception_cleanup = exception_cleanup_func;
+    return exception_header;
 }
 
 
@@ -222,18 +375,12 @@ LIBCXXABI_NORETURN
 void 
 __cxa_throw(void* thrown_object, std::type_info* tinfo, void (*dest)(void*))
 {
-    __cxa_eh_globals *globals = __cxa_get_globals();
-    __cxa_exception* exception_header = cxa_exception_from_thrown_object(thrown_object);
+    __cxa_eh_globals *globals = __get_eh_globals();
+    __cxa_exception* exception_header = __cxa_init_primary_exception(thrown_object, tinfo, dest);
 
-    exception_header->unexpectedHandler = std::get_unexpected();
-    exception_header->terminateHandler  = std::get_terminate();
-    exception_header->exceptionType = tinfo;
-    exception_header->exceptionDestructor = dest;
-    setExceptionClass(&exception_header->unwindHeader);
     exception_header->referenceCount = 1;  // This is a newly allocated exception, no need for thread safety.
     globals->uncaughtExceptions += 1;   // Not atomically, since globals are thread-local
 
-    exception_header->unwindHeader.exception_cleanup = exception_cleanup_func;
 #if __USING_SJLJ_EXCEPTIONS__
     _Unwind_SjLj_RaiseException(&exception_header->unwindHeader);
 #else
@@ -276,7 +423,7 @@ bool
 __cxa_begin_cleanup(void* unwind_arg) throw ()
 {
     _Unwind_Exception* unwind_exception = static_cast<_Unwind_Exception*>(unwind_arg);
-    __cxa_eh_globals* globals = __cxa_get_globals();
+    __cxa_eh_globals* globals = __get_eh_globals();
     __cxa_exception* exception_header =
         cxa_exception_from_exception_unwind_exception(unwind_exception);
 
@@ -314,7 +461,7 @@ align the stack to 16 bytes, even though it is a callee-save register.
 __attribute__((used)) static _Unwind_Exception *
 __cxa_end_cleanup_impl()
 {
-    __cxa_eh_globals* globals = __cxa_get_globals();
+    __cxa_eh_globals* globals = __get_eh_globals();
     __cxa_exception* exception_header = globals->propagatingExceptions;
     if (NULL == exception_header)
     {
@@ -389,7 +536,7 @@ __cxa_begin_catch(void* unwind_arg) throw()
 {
     _Unwind_Exception* unwind_exception = static_cast<_Unwind_Exception*>(unwind_arg);
     bool native_exception = isOurExceptionClass(unwind_exception);
-    __cxa_eh_globals* globals = __cxa_get_globals();
+    __cxa_eh_globals* globals = __get_eh_globals();
     // exception_header is a hackish offset from a foreign exception, but it
     //   works as long as we're careful not to try to access any __cxa_exception
     //   parts.
@@ -458,7 +605,7 @@ void __cxa_end_catch()
                       offsetof(__cxa_dependent_exception, handlerCount),
                   "the layout of __cxa_exception must match the layout of "
                   "__cxa_dependent_exception");
-    __cxa_eh_globals* globals = __cxa_get_globals_fast(); // __cxa_get_globals called in __cxa_begin_catch
+    __cxa_eh_globals* globals = __get_eh_globals_fast(); // __cxa_get_globals called in __cxa_begin_catch
     __cxa_exception* exception_header = globals->caughtExceptions;
     // If we've rethrown a foreign exception, then globals->caughtExceptions
     //    will have been made an empty stack by __cxa_rethrow() and there is
@@ -524,7 +671,7 @@ void __cxa_end_catch()
 //        However watch out for foreign exceptions.  Return null for them.
 std::type_info * __cxa_current_exception_type() {
 //  get the current exception
-    __cxa_eh_globals *globals = __cxa_get_globals_fast();
+    __cxa_eh_globals *globals = __get_eh_globals_fast();
     if (NULL == globals)
         return NULL;     //  If there have never been any exceptions, there are none now.
     __cxa_exception *exception_header = globals->caughtExceptions;
@@ -551,7 +698,7 @@ LIBCXXABI_NORETURN
 void
 __cxa_rethrow()
 {
-    __cxa_eh_globals* globals = __cxa_get_globals();
+    __cxa_eh_globals* globals = __get_eh_globals();
     __cxa_exception* exception_header = globals->caughtExceptions;
     if (NULL == exception_header)
         std::terminate();      // throw; called outside of a exception handler
@@ -642,7 +789,7 @@ void*
 __cxa_current_primary_exception() throw()
 {
 //  get the current exception
-    __cxa_eh_globals* globals = __cxa_get_globals_fast();
+    __cxa_eh_globals* globals = __get_eh_globals_fast();
     if (NULL == globals)
         return NULL;        //  If there are no globals, there is no exception
     __cxa_exception* exception_header = globals->caughtExceptions;
@@ -698,7 +845,7 @@ __cxa_rethrow_primary_exception(void* thrown_object)
         dep_exception_header->unexpectedHandler = std::get_unexpected();
         dep_exception_header->terminateHandler = std::get_terminate();
         setDependentExceptionClass(&dep_exception_header->unwindHeader);
-        __cxa_get_globals()->uncaughtExceptions += 1;
+        __get_eh_globals()->uncaughtExceptions += 1;
         dep_exception_header->unwindHeader.exception_cleanup = dependent_exception_cleanup;
 #if __USING_SJLJ_EXCEPTIONS__
         _Unwind_SjLj_RaiseException(&dep_exception_header->unwindHeader);
@@ -715,7 +862,7 @@ bool
 __cxa_uncaught_exception() throw()
 {
     // This does not report foreign exceptions in flight
-    __cxa_eh_globals* globals = __cxa_get_globals_fast();
+    __cxa_eh_globals* globals = __get_eh_globals_fast();
     if (globals == 0)
         return false;
     return globals->uncaughtExceptions != 0;
@@ -15,7 +15,10 @@
 #define _CXA_EXCEPTION_H
 
 #include <exception> // for std::unexpected_handler and std::terminate_handler
+#include <new>       // for placement new
+#include <typeinfo>
 #include <cxxabi.h>
+#include "config.h"
 #include "unwind.h"
 
 namespace __cxxabiv1 {
@@ -25,6 +28,17 @@ namespace __cxxabiv1 {
 static const uint64_t kOurExceptionClass          = 0x434C4E47432B2B00; // CLNGC++\0
 static const uint64_t kOurDependentExceptionClass = 0x434C4E47432B2B01; // CLNGC++\1
 static const uint64_t get_vendor_and_language =     0xFFFFFFFFFFFFFF00; // mask for CLNGC++
+
+// Each thread keeps a few freed exception blocks around for reuse, in size
+// classes of 256, 512 and 1024 bytes.
+static const size_t kExceptionCacheClasses   = 3;
+static const size_t kExceptionCacheDepth     = 4;   // blocks per class
+static const size_t kExceptionCacheMinBlock  = 256;
+
+// A handful of statically allocated blocks are set aside for throwing
+// std::bad_alloc and std::bad_array_new_length.
+static const size_t kReservedExceptions      = 16;
+static const size_t kReservedExceptionBlock  = 256;
                                                     
 struct __cxa_exception { 
 #if __LP64__ || LIBCXXABI_ARM_EHABI
@@ -107,6 +121,11 @@ struct __cxa_eh_globals {
 #if LIBCXXABI_ARM_EHABI
     __cxa_exception* propagatingExceptions;
 #endif
+    // Freed exception blocks, kept for reuse by cxa_exception.cpp.
+    void *              exceptionCache[kExceptionCacheClasses];
+    unsigned char       exceptionCacheCount[kExceptionCacheClasses];
+    bool                exceptionCacheRegistered;
+    bool                exceptionCacheReleased;     // the thread is exiting
 };
 
 #pragma GCC visibility pop
@@ -118,6 +137,50 @@ extern "C" __cxa_eh_globals * __cxa_get_globals_fast ();
 extern "C" void * __cxa_allocate_dependent_exception ();
 extern "C" void __cxa_free_dependent_exception (void * dependent_exception);
 
+#pragma GCC visibility pop
+#pragma GCC visibility push(hidden)
+
+//  Returns the blocks in the exception cache of globals to the heap.
+//  Defined in cxa_exception.cpp.
+void __release_exception_cache (__cxa_eh_globals * globals);
+
+//  Arranges for __release_exception_cache to be called on globals when the
+//  calling thread exits.  Defined in cxa_exception_storage.cpp.
+void __register_exception_cache (__cxa_eh_globals * globals);
+
+//  Like __cxa_allocate_exception, but tries the blocks reserved for
+//  out-of-memory exceptions first, so that it needs neither the heap nor the
+//  emergency pool.  Defined in cxa_exception.cpp.
+void * __cxa_allocate_reserved_exception (size_t thrown_size) throw();
+
+template <class _Tp>
+void __destroy_exception (void * thrown_object) {
+    static_cast<_Tp*>(thrown_object)->~_Tp();
+    }
+
+//  Throws a default constructed _Tp, allocated from the reserved blocks.
+template <class _Tp>
+LIBCXXABI_NORETURN void __throw_reserved_exception () {
+    void * thrown_object = __cxa_allocate_reserved_exception (sizeof (_Tp));
+    ::new (thrown_object) _Tp;
+    __cxa_throw (thrown_object, const_cast<std::type_info*>(&typeid(_Tp)),
+                 __destroy_exception<_Tp>);
+    }
+
+//  Inlinable equivalents of __cxa_get_globals and __cxa_get_globals_fast for
+//  use within libc++abi.  With LIBCXXABI_HAS_TLS_EH_GLOBALS the globals are
+//  a single thread-pointer relative access away and are never NULL.
+#if LIBCXXABI_HAS_TLS_EH_GLOBALS
+extern __thread __cxa_eh_globals __eh_globals
+    __attribute__((tls_model("initial-exec")));
+
+inline __cxa_eh_globals * __get_eh_globals      () { return &__eh_globals; }
+inline __cxa_eh_globals * __get_eh_globals_fast () { return &__eh_globals; }
+#else
+inline __cxa_eh_globals * __get_eh_globals      () { return __cxa_get_globals (); }
+inline __cxa_eh_globals * __get_eh_globals_fast () { return __cxa_get_globals_fast (); }
+#endif
+
 #pragma GCC visibility pop
 
 }  // namespace __cxxabiv1
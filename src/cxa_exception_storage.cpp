@@ -23,6 +23,25 @@ extern "C" {
     __cxa_eh_globals *__cxa_get_globals() { return &eh_globals; }
     __cxa_eh_globals *__cxa_get_globals_fast() { return &eh_globals; }
     }
+
+//  There is only one thread, and it never exits.
+void __register_exception_cache (__cxa_eh_globals *) {}
+}
+
+#elif LIBCXXABI_HAS_TLS_EH_GLOBALS
+
+//  The storage is zero-initialized by the loader for every thread, so there
+//  is nothing to construct and nothing to free at thread exit other than the
+//  exception cache, see below.
+
+namespace __cxxabiv1 {
+
+__thread __cxa_eh_globals __eh_globals __attribute__((tls_model("initial-exec")));
+
+extern "C" {
+    __cxa_eh_globals * __cxa_get_globals      () { return __get_eh_globals (); }
+    __cxa_eh_globals * __cxa_get_globals_fast () { return __get_eh_globals_fast (); }
+    }
 }
 
 #elif defined(HAS_THREAD_LOCAL)
@@ -58,6 +77,7 @@ namespace {
     pthread_once_t flag_ = PTHREAD_ONCE_INIT;
 
     void destruct_ (void *p) {
+        __release_exception_cache ( static_cast<__cxa_eh_globals*> ( p ));
         std::free ( p );
         if ( 0 != ::pthread_setspecific ( key_, NULL ) ) 
             abort_message("cannot zero out thread value for __cxa_get_globals()");
@@ -99,5 +119,43 @@ extern "C" {
         }
     
 }
+
+//  destruct_ already takes care of the exception cache.
+void __register_exception_cache (__cxa_eh_globals *) {}
 }
 #endif
+
+#if !LIBCXXABI_HAS_NO_THREADS && \
+    (LIBCXXABI_HAS_TLS_EH_GLOBALS || defined(HAS_THREAD_LOCAL))
+
+#include <pthread.h>
+#include "abort_message.h"
+
+//  The globals themselves need no cleanup in these configurations, but a
+//  thread that has cached exception blocks must hand them back to the heap
+//  when it exits.  The key is only set on threads that cached something.
+
+namespace __cxxabiv1 {
+namespace {
+    pthread_key_t  cache_key_;
+    pthread_once_t cache_flag_ = PTHREAD_ONCE_INIT;
+
+    void release_cache_ (void *p) {
+        __release_exception_cache ( static_cast<__cxa_eh_globals*> ( p ));
+        }
+
+    void construct_cache_key_ () {
+        if ( 0 != pthread_key_create ( &cache_key_, release_cache_ ) )
+            abort_message("cannot create pthread key for the exception cache");
+        }
+}
+
+void __register_exception_cache (__cxa_eh_globals *globals) {
+    if ( 0 != pthread_once ( &cache_flag_, construct_cache_key_ ) )
+        abort_message("pthread_once failure in __register_exception_cache()");
+    if ( 0 != pthread_setspecific ( cache_key_, globals ) )
+        abort_message("pthread_setspecific failure in __register_exception_cache()");
+    }
+}
+
+#endif
@@ -10,11 +10,31 @@
 #include "abort_message.h"
 #include "config.h"
 
-#if !LIBCXXABI_HAS_NO_THREADS
+#if !LIBCXXABI_HAS_NO_THREADS && defined(__linux__)
+#  define LIBCXXABI_GUARD_USE_FUTEX 1
+#else
+#  define LIBCXXABI_GUARD_USE_FUTEX 0
+#endif
+
+#if LIBCXXABI_GUARD_USE_FUTEX
+#  include <limits.h>
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#elif !LIBCXXABI_HAS_NO_THREADS
 #  include <pthread.h>
 #endif
+#include <stddef.h>
 #include <stdint.h>
 
+#if LIBCXXABI_GUARD_PROFILE
+#  include <dlfcn.h>
+#  include <stdio.h>
+#  include <stdlib.h>
+#  include <time.h>
+#  include "cxxabi.h"
+#endif
+
 /*
     This implementation must be careful to not call code external to this file
     which will turn around and try to call __cxa_guard_acquire reentrantly.
@@ -22,7 +42,8 @@
     Previous implementations of this code for __APPLE__ have used
     pthread_mutex_lock and the abort_message utility without problem.  This
     implementation also uses pthread_cond_wait which has tested to not be a
-    problem.
+    problem.  On Linux the guard itself is used as the lock and threads wait
+    on it with a raw futex system call, so no library code is involved.
 */
 
 namespace __cxxabiv1
@@ -37,32 +58,96 @@ namespace
 // be statically initialized to 0.
 typedef uint32_t guard_type;
 
-// Test the lowest bit.
+// Test the lowest bit.  The acquire pairs with the release in
+// set_initialized so that a thread which observes the bit also observes the
+// initialized object.
 inline bool is_initialized(guard_type* guard_object) {
-    return (*guard_object) & 1;
+    return __atomic_load_n(guard_object, __ATOMIC_ACQUIRE) & 1;
 }
 
 inline void set_initialized(guard_type* guard_object) {
-    *guard_object |= 1;
+    __atomic_store_n(guard_object, *guard_object | 1, __ATOMIC_RELEASE);
 }
 
 #else
 
 typedef uint64_t guard_type;
 
-bool is_initialized(guard_type* guard_object) {
+// The first byte of the guard is the initialized flag, which is also what
+// the compiler's inline check tests.
+inline bool is_initialized(guard_type* guard_object) {
     char* initialized = (char*)guard_object;
-    return *initialized;
+    return __atomic_load_n(initialized, __ATOMIC_ACQUIRE);
 }
 
-void set_initialized(guard_type* guard_object) {
+inline void set_initialized(guard_type* guard_object) {
     char* initialized = (char*)guard_object;
-    *initialized = 1;
+    __atomic_store_n(initialized, 1, __ATOMIC_RELEASE);
+}
+
+#endif
+
+#if LIBCXXABI_GUARD_USE_FUTEX
+
+// Each guard carries its own lock state in a 32-bit word, and threads
+// waiting for an initialization to finish sleep on that word with futex(2).
+// A waiter is only woken when its own guard is released or aborted.
+//
+// While the guard is locked the state holds the kernel thread id of the
+// owner, which lets a thread that re-enters its own initialization be
+// detected without any global bookkeeping.  Linux thread ids are bounded by
+// PID_MAX_LIMIT (2^22), so they fit above the flag bits.
+//
+// On ARM the guard is a single word whose lowest bit is the initialized flag,
+// so the lock state shares that word.  Elsewhere the first byte is the
+// initialized flag and the second half of the 64-bit guard holds the state.
+
+#if __arm__
+
+const uint32_t initialized_bit = 1 << 0;
+const uint32_t waiting_bit     = 1 << 1;
+const unsigned owner_shift     = 2;
+
+inline uint32_t* get_state(guard_type* guard_object) {
+    return guard_object;
+}
+
+#else
+
+const uint32_t initialized_bit = 0;  // Kept in the first byte instead.
+const uint32_t waiting_bit     = 1 << 0;
+const unsigned owner_shift     = 1;
+
+inline uint32_t* get_state(guard_type* guard_object) {
+    return reinterpret_cast<uint32_t*>(guard_object) + 1;
 }
 
 #endif
 
-#if !LIBCXXABI_HAS_NO_THREADS
+const uint32_t owner_mask = ~(initialized_bit | waiting_bit);
+
+// Returns the calling thread's id, encoded the way it is stored in the state.
+inline uint32_t get_owner_id() {
+    return static_cast<uint32_t>(syscall(SYS_gettid)) << owner_shift;
+}
+
+inline void futex_wait(uint32_t* state, uint32_t expected) {
+    // EINTR and EAGAIN are both fine, the caller rechecks the state.
+    syscall(SYS_futex, state, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+inline void futex_wake_all(uint32_t* state) {
+    syscall(SYS_futex, state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// Stores value into the state word, dropping the lock, and wakes up every
+// thread sleeping on it if there were any.
+inline void unlock(uint32_t* state, uint32_t value) {
+    if (__atomic_exchange_n(state, value, __ATOMIC_RELEASE) & waiting_bit)
+        futex_wake_all(state);
+}
+
+#elif !LIBCXXABI_HAS_NO_THREADS
 pthread_mutex_t guard_mut = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t  guard_cv  = PTHREAD_COND_INITIALIZER;
 #endif
@@ -161,6 +246,134 @@ set_lock(uint32_t& x, lock_type y)
 
 #endif  // __APPLE__
 
+#if LIBCXXABI_GUARD_PROFILE
+
+// Per-guard contention statistics, kept in a fixed-size open addressing table
+// so that recording never allocates.  Only calls that find the guard not yet
+// initialized are recorded; the fast path never touches the table.  Entries
+// are claimed by a CAS of the guard address from NULL to claiming_guard, and
+// the address is stored once caller is set, so anyone who sees the address
+// also sees caller.  Entries are never released.  Guards that do not fit are
+// counted in profile_dropped.
+
+const size_t profile_table_size = 4096;  // Must be a power of 2.
+
+struct profile_entry
+{
+    guard_type* guard;
+    void* caller;
+    uint64_t acquires;
+    uint64_t contended;
+    uint64_t wait_ns;
+};
+
+profile_entry profile_table[profile_table_size];
+uint64_t profile_dropped;
+
+// Never a valid guard address since guards are at least 4 byte aligned.
+guard_type* const claiming_guard = reinterpret_cast<guard_type*>(1);
+
+profile_entry* find_profile_entry(guard_type* guard_object, void* caller)
+{
+    uintptr_t key = reinterpret_cast<uintptr_t>(guard_object);
+    size_t i = static_cast<size_t>((key >> 3) ^ (key >> 15));
+    for (size_t n = 0; n < profile_table_size; ++n, ++i)
+    {
+        profile_entry& entry = profile_table[i & (profile_table_size - 1)];
+        guard_type* guard = __atomic_load_n(&entry.guard, __ATOMIC_ACQUIRE);
+        if (guard == NULL &&
+            __atomic_compare_exchange_n(&entry.guard, &guard, claiming_guard,
+                                        false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_ACQUIRE))
+        {
+            __atomic_store_n(&entry.caller, caller, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry.guard, guard_object, __ATOMIC_RELEASE);
+            return &entry;
+        }
+        // The claim is only two stores away from completing, and the entry
+        // may be for this guard.
+        while (guard == claiming_guard)
+            guard = __atomic_load_n(&entry.guard, __ATOMIC_ACQUIRE);
+        if (guard == guard_object)
+            return &entry;
+    }
+    __atomic_add_fetch(&profile_dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+inline uint64_t profile_now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 +
+           static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Accumulates the time one __cxa_guard_acquire call spends waiting for other
+// threads and records it when the call returns.  Constructed only once the
+// call has seen that the guard is not yet initialized.
+class guard_profile
+{
+    guard_type* guard_object_;
+    void* caller_;
+    uint64_t start_;
+    uint64_t wait_ns_;
+    bool contended_;
+
+public:
+    guard_profile(guard_type* guard_object, void* caller)
+        : guard_object_(guard_object), caller_(caller), start_(0),
+          wait_ns_(0), contended_(false) {}
+
+    ~guard_profile()
+    {
+        profile_entry* entry = find_profile_entry(guard_object_, caller_);
+        if (entry == NULL)
+            return;
+        __atomic_add_fetch(&entry->acquires, 1, __ATOMIC_RELAXED);
+        if (contended_)
+        {
+            __atomic_add_fetch(&entry->contended, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&entry->wait_ns, wait_ns_, __ATOMIC_RELAXED);
+        }
+    }
+
+    void start_wait()
+    {
+        contended_ = true;
+        start_ = profile_now();
+    }
+
+    void stop_wait() {wait_ns_ += profile_now() - start_;}
+};
+
+// Prints the symbol containing addr, or returns false if there is none.
+bool print_symbol(void* addr)
+{
+    Dl_info info;
+    if (!dladdr(addr, &info) || info.dli_sname == NULL)
+        return false;
+    int status;
+    char* demangled = __cxa_demangle(info.dli_sname, NULL, NULL, &status);
+    fprintf(stderr, "%s", demangled ? demangled : info.dli_sname);
+    free(demangled);
+    if (info.dli_fname)
+        fprintf(stderr, " (%s)", info.dli_fname);
+    return true;
+}
+
+#else  // !LIBCXXABI_GUARD_PROFILE
+
+class guard_profile
+{
+public:
+    guard_profile(guard_type*, void*) {}
+    void start_wait() {}
+    void stop_wait() {}
+};
+
+#endif  // LIBCXXABI_GUARD_PROFILE
+
 }  // unnamed namespace
 
 extern "C"
@@ -183,14 +396,77 @@ void __cxa_guard_abort(guard_type* guard_object)
     *guard_object = 0;
 }
 
-#else // !LIBCXXABI_HAS_NO_THREADS
+#elif LIBCXXABI_GUARD_USE_FUTEX
 
 int __cxa_guard_acquire(guard_type* guard_object)
 {
-    char* initialized = (char*)guard_object;
+    if (is_initialized(guard_object))
+        return 0;
+    guard_profile profile(guard_object, __builtin_return_address(0));
+    const uint32_t id = get_owner_id();
+    uint32_t* state = get_state(guard_object);
+    do
+    {
+        // The failure order is acquire too, since seeing initialized_bit
+        // below is enough to return 0, and the caller then reads the object.
+        uint32_t value = 0;
+        if (__atomic_compare_exchange_n(state, &value, id, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            // Another thread may have finished the initialization between
+            // the check above and taking the lock.
+            if (!is_initialized(guard_object))
+                return 1;
+            unlock(state, initialized_bit);
+            return 0;
+        }
+        if (value & initialized_bit)
+            return 0;
+        // if this thread set lock for this same guard_object, abort
+        if ((value & owner_mask) == id)
+            abort_message("__cxa_guard_acquire detected deadlock");
+        // Somebody else holds the lock.  Advertise that there is a waiter so
+        // that they know to wake us, then sleep until the state changes.
+        if (!(value & waiting_bit))
+        {
+            if (!__atomic_compare_exchange_n(state, &value, value | waiting_bit,
+                                             false, __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED))
+                continue;
+            value |= waiting_bit;
+        }
+        profile.start_wait();
+        futex_wait(state, value);
+        profile.stop_wait();
+    } while (!is_initialized(guard_object));
+    return 0;
+}
+
+void __cxa_guard_release(guard_type* guard_object)
+{
+#if !__arm__
+    set_initialized(guard_object);
+#endif
+    unlock(get_state(guard_object), initialized_bit);
+}
+
+void __cxa_guard_abort(guard_type* guard_object)
+{
+    unlock(get_state(guard_object), 0);
+}
+
+#else // !LIBCXXABI_HAS_NO_THREADS && !LIBCXXABI_GUARD_USE_FUTEX
+
+int __cxa_guard_acquire(guard_type* guard_object)
+{
+    // Once initialization has completed the guard never changes again, so
+    // there is no need to serialize on guard_mut to observe that.
+    if (is_initialized(guard_object))
+        return 0;
+    guard_profile profile(guard_object, __builtin_return_address(0));
     if (pthread_mutex_lock(&guard_mut))
         abort_message("__cxa_guard_acquire failed to acquire mutex");
-    int result = *initialized == 0;
+    int result = !is_initialized(guard_object);
     if (result)
     {
 #if defined(__APPLE__) && !defined(__arm__)
@@ -201,12 +477,14 @@ int __cxa_guard_acquire(guard_type* guard_object)
             // if this thread set lock for this same guard_object, abort
             if (lock == id)
                 abort_message("__cxa_guard_acquire detected deadlock");
+            profile.start_wait();
             do
             {
                 if (pthread_cond_wait(&guard_cv, &guard_mut))
                     abort_message("__cxa_guard_acquire condition variable wait failed");
                 lock = get_lock(*guard_object);
             } while (lock);
+            profile.stop_wait();
             result = !is_initialized(guard_object);
             if (result)
                 set_lock(*guard_object, id);
@@ -214,10 +492,15 @@ int __cxa_guard_acquire(guard_type* guard_object)
         else
             set_lock(*guard_object, id);
 #else  // !__APPLE__ || __arm__
-        while (get_lock(*guard_object))
-            if (pthread_cond_wait(&guard_cv, &guard_mut))
-                abort_message("__cxa_guard_acquire condition variable wait failed");
-        result = *initialized == 0;
+        if (get_lock(*guard_object))
+        {
+            profile.start_wait();
+            while (get_lock(*guard_object))
+                if (pthread_cond_wait(&guard_cv, &guard_mut))
+                    abort_message("__cxa_guard_acquire condition variable wait failed");
+            profile.stop_wait();
+        }
+        result = !is_initialized(guard_object);
         if (result)
             set_lock(*guard_object, true);
 #endif  // !__APPLE__ || __arm__
@@ -231,7 +514,9 @@ void __cxa_guard_release(guard_type* guard_object)
 {
     if (pthread_mutex_lock(&guard_mut))
         abort_message("__cxa_guard_release failed to acquire mutex");
-    *guard_object = 0;
+    // Readers on the fast path may be looking at the guard concurrently, so
+    // every store to it must be atomic.
+    __atomic_store_n(guard_object, 0, __ATOMIC_RELAXED);
     set_initialized(guard_object);
     if (pthread_mutex_unlock(&guard_mut))
         abort_message("__cxa_guard_release failed to release mutex");
@@ -243,14 +528,86 @@ void __cxa_guard_abort(guard_type* guard_object)
 {
     if (pthread_mutex_lock(&guard_mut))
         abort_message("__cxa_guard_abort failed to acquire mutex");
-    *guard_object = 0;
+    __atomic_store_n(guard_object, 0, __ATOMIC_RELAXED);
     if (pthread_mutex_unlock(&guard_mut))
         abort_message("__cxa_guard_abort failed to release mutex");
     if (pthread_cond_broadcast(&guard_cv))
         abort_message("__cxa_guard_abort failed to broadcast condition variable");
 }
 
-#endif // !LIBCXXABI_HAS_NO_THREADS
+#endif // !LIBCXXABI_HAS_NO_THREADS && !LIBCXXABI_GUARD_USE_FUTEX
+
+#if LIBCXXABI_GUARD_PROFILE
+
+size_t __cxa_guard_profile_dump(size_t top_n)
+{
+    bool reported[profile_table_size] = {};
+    size_t count = 0;
+    for (; count < top_n; ++count)
+    {
+        // Pick the unreported guard with the longest total wait, breaking
+        // ties by the number of acquires.
+        // The counters keep changing while other threads run, so each one
+        // is loaded once and the printed values are the ones compared.
+        profile_entry* best = NULL;
+        guard_type* best_guard = NULL;
+        uint64_t best_acquires = 0;
+        uint64_t best_wait_ns = 0;
+        size_t best_index = 0;
+        for (size_t i = 0; i < profile_table_size; ++i)
+        {
+            profile_entry& entry = profile_table[i];
+            if (reported[i])
+                continue;
+            guard_type* guard = __atomic_load_n(&entry.guard, __ATOMIC_ACQUIRE);
+            if (guard == NULL || guard == claiming_guard)
+                continue;
+            uint64_t acquires = __atomic_load_n(&entry.acquires, __ATOMIC_RELAXED);
+            uint64_t wait_ns = __atomic_load_n(&entry.wait_ns, __ATOMIC_RELAXED);
+            if (best == NULL || wait_ns > best_wait_ns ||
+                (wait_ns == best_wait_ns && acquires > best_acquires))
+            {
+                best = &entry;
+                best_guard = guard;
+                best_acquires = acquires;
+                best_wait_ns = wait_ns;
+                best_index = i;
+            }
+        }
+        if (best == NULL)
+            break;
+        reported[best_index] = true;
+        fprintf(stderr, "%p acquires=%llu contended=%llu wait_ns=%llu ",
+                static_cast<void*>(best_guard),
+                static_cast<unsigned long long>(best_acquires),
+                static_cast<unsigned long long>(__atomic_load_n(&best->contended, __ATOMIC_RELAXED)),
+                static_cast<unsigned long long>(best_wait_ns));
+        // Guard variables for statics in functions with internal linkage
+        // have no dynamic symbol, so fall back to the function that asked.
+        if (!print_symbol(best_guard))
+        {
+            void* caller = __atomic_load_n(&best->caller, __ATOMIC_RELAXED);
+            fprintf(stderr, "in ");
+            if (!print_symbol(caller))
+                fprintf(stderr, "%p", caller);
+        }
+        fprintf(stderr, "\n");
+    }
+    uint64_t dropped = __atomic_load_n(&profile_dropped, __ATOMIC_RELAXED);
+    if (dropped)
+        fprintf(stderr, "%llu acquires not recorded, profile table full\n",
+                static_cast<unsigned long long>(dropped));
+    return count;
+}
+
+#else  // !LIBCXXABI_GUARD_PROFILE
+
+size_t __cxa_guard_profile_dump(size_t)
+{
+    return 0;
+}
+
+#endif  // LIBCXXABI_GUARD_PROFILE
 
 }  // extern "C"
 
@@ -13,6 +13,7 @@
 
 #include <new>
 #include <cstdlib>
+#include "cxa_exception.hpp"
 
 /*
 [new.delete.single]
@@ -47,7 +48,7 @@ operator new(std::size_t size)
         if (nh)
             nh();
         else
-            throw std::bad_alloc();
+            __cxxabiv1::__throw_reserved_exception<std::bad_alloc>();
     }
     return p;
 }
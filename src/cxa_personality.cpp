@@ -527,6 +527,267 @@ set_registers(_Unwind_Exception* unwind_exception, _Unwind_Context* context,
     _Unwind_SetIP(context, results.landingPad);
 }
 
+#if !__USING_SJLJ_EXCEPTIONS__ && LIBCXXABI_LSDA_INDEX_SLOTS > 0
+/*
+    A decoded index of the call-site table of one LSDA.
+
+    The call sites are sorted by start, so once their variable length entries
+    have been decoded a binary search finds the one containing ip instead of
+    a walk over every entry before it.  Only tables of at least
+    lsda_index_min_table_length bytes are indexed; shorter ones are cheaper
+    to walk.
+
+    The indexes live in a fixed-size open-addressed table.  Each is built by
+    the first thread to need it, published with a compare-and-swap and never
+    freed, so looking one up takes no lock.  An index is looked for within
+    max_lsda_index_probes slots of its hash.  Once the table is full, or
+    lsda_index_max_call_sites call sites have been indexed in all, other LSDAs
+    are walked as before.  An LSDA that is refused an index gets an empty one
+    where possible, so that it is not decoded again on every throw.
+
+    An index is matched on the start of the function and the length of its
+    call-site table as well as the address of the LSDA, so that an LSDA
+    unloaded by dlclose and replaced by another at the same address is not
+    taken for the old one.
+*/
+struct lsda_call_site
+{
+    uintptr_t start;
+    uintptr_t end;
+    uint32_t  entry;    // offset of the entry in the call-site table
+};
+
+struct lsda_index
+{
+    const uint8_t* lsda;
+    uintptr_t      funcStart;
+    uint32_t       callSiteTableLength;
+    uint32_t       count;
+    lsda_call_site sites[1];
+};
+
+static const uint32_t lsda_index_min_table_length = 64;
+static const size_t   lsda_index_max_call_sites = 64 * 1024;
+static const size_t   max_lsda_index_probes = 16;
+
+static lsda_index* lsda_indexes[LIBCXXABI_LSDA_INDEX_SLOTS];
+static size_t lsda_indexed_call_sites = 0;
+
+/// @returns an index with no call sites, which marks an LSDA as not indexed
+static
+lsda_index*
+refuse_lsda_index(const uint8_t* lsda, uintptr_t funcStart,
+                  uint32_t callSiteTableLength)
+{
+    lsda_index* index = static_cast<lsda_index*>(malloc(sizeof(lsda_index)));
+    if (index == NULL)
+        return NULL;
+    index->lsda = lsda;
+    index->funcStart = funcStart;
+    index->callSiteTableLength = callSiteTableLength;
+    index->count = 0;
+    return index;
+}
+
+/// @returns the index of the LSDA, an empty index if it is not to be indexed,
+///          or null if there is no memory for either
+static
+lsda_index*
+build_lsda_index(const uint8_t* lsda, uintptr_t funcStart,
+                 uint8_t callSiteEncoding, const uint8_t* callSiteTableStart,
+                 uint32_t callSiteTableLength)
+{
+    // Don't decode the table only to find that there is no room for it
+    if (__atomic_load_n(&lsda_indexed_call_sites, __ATOMIC_RELAXED) >=
+        lsda_index_max_call_sites)
+        return refuse_lsda_index(lsda, funcStart, callSiteTableLength);
+    const uint8_t* callSiteTableEnd = callSiteTableStart + callSiteTableLength;
+    size_t count = 0;
+    for (const uint8_t* p = callSiteTableStart; p < callSiteTableEnd; ++count)
+    {
+        readEncodedPointer(&p, callSiteEncoding);
+        readEncodedPointer(&p, callSiteEncoding);
+        readEncodedPointer(&p, callSiteEncoding);
+        readULEB128(&p);
+    }
+    if (count == 0)
+        return refuse_lsda_index(lsda, funcStart, callSiteTableLength);
+    if (__atomic_add_fetch(&lsda_indexed_call_sites, count, __ATOMIC_RELAXED) >
+        lsda_index_max_call_sites)
+    {
+        __atomic_sub_fetch(&lsda_indexed_call_sites, count, __ATOMIC_RELAXED);
+        return refuse_lsda_index(lsda, funcStart, callSiteTableLength);
+    }
+    lsda_index* index = static_cast<lsda_index*>(
+        malloc(sizeof(lsda_index) + (count - 1) * sizeof(lsda_call_site)));
+    if (index == NULL)
+    {
+        __atomic_sub_fetch(&lsda_indexed_call_sites, count, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    index->lsda = lsda;
+    index->funcStart = funcStart;
+    index->callSiteTableLength = callSiteTableLength;
+    index->count = static_cast<uint32_t>(count);
+    lsda_call_site* site = index->sites;
+    for (const uint8_t* p = callSiteTableStart; p < callSiteTableEnd; ++site)
+    {
+        site->entry = static_cast<uint32_t>(p - callSiteTableStart);
+        site->start = readEncodedPointer(&p, callSiteEncoding);
+        site->end = site->start + readEncodedPointer(&p, callSiteEncoding);
+        readEncodedPointer(&p, callSiteEncoding);
+        readULEB128(&p);
+    }
+    return index;
+}
+
+static
+void
+free_lsda_index(lsda_index* index)
+{
+    __atomic_sub_fetch(&lsda_indexed_call_sites, index->count, __ATOMIC_RELAXED);
+    free(index);
+}
+
+/// Find the index of an LSDA, building it if there is none yet
+/// @returns the index, or null if the LSDA is not indexed
+static
+const lsda_index*
+find_lsda_index(const uint8_t* lsda, uintptr_t funcStart,
+                uint8_t callSiteEncoding, const uint8_t* callSiteTableStart,
+                uint32_t callSiteTableLength)
+{
+    lsda_index* built = NULL;
+    size_t hash = (reinterpret_cast<uintptr_t>(lsda) >> 2) * 2654435761U;
+    for (size_t i = 0; i < max_lsda_index_probes; ++i)
+    {
+        lsda_index** slot = &lsda_indexes[(hash + i) % LIBCXXABI_LSDA_INDEX_SLOTS];
+        lsda_index* index = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (index == NULL)
+        {
+            if (built == NULL)
+                built = build_lsda_index(lsda, funcStart, callSiteEncoding,
+                                         callSiteTableStart, callSiteTableLength);
+            if (built == NULL)
+                return NULL;
+            if (__atomic_compare_exchange_n(slot, &index, built, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return built->count != 0 ? built : NULL;
+            // Another thread filled the slot first; index is its entry
+        }
+        if (index->lsda == lsda && index->funcStart == funcStart &&
+            index->callSiteTableLength == callSiteTableLength)
+        {
+            if (built != NULL)
+                free_lsda_index(built);
+            return index->count != 0 ? index : NULL;
+        }
+    }
+    if (built != NULL)
+        free_lsda_index(built);
+    return NULL;
+}
+
+/// @returns the entry of the call site containing ipOffset if there is one,
+///          else the first entry after ipOffset, else the end of the table,
+///          which is where a walk of the table would stop
+static
+const uint8_t*
+lookup_call_site(const lsda_index* index, uintptr_t ipOffset,
+                 const uint8_t* callSiteTableStart)
+{
+    uint32_t lo = 0;
+    uint32_t hi = index->count;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index->sites[mid].start <= ipOffset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && ipOffset < index->sites[lo - 1].end)
+        return callSiteTableStart + index->sites[lo - 1].entry;
+    if (lo < index->count)
+        return callSiteTableStart + index->sites[lo].entry;
+    return callSiteTableStart + index->callSiteTableLength;
+}
+#endif  // !__USING_SJLJ_EXCEPTIONS__ && LIBCXXABI_LSDA_INDEX_SLOTS > 0
+
+#if !__USING_SJLJ_EXCEPTIONS__
+/*
+    Walking the call-site table to the entry for ip decodes three encoded
+    pointers per entry.  Compilers only use a couple of encodings for them,
+    so for those the walk is instantiated per encoding, which turns each
+    field into a plain load instead of a trip through readEncodedPointer.
+    The encoding is dispatched on once per table.
+*/
+extern "C++"
+{
+
+template <uint8_t encoding> struct call_site_field;
+
+template <>
+struct call_site_field<DW_EH_PE_uleb128>
+{
+    static uintptr_t read(const uint8_t** data) {return readULEB128(data);}
+};
+
+template <>
+struct call_site_field<DW_EH_PE_udata4>
+{
+    static uintptr_t read(const uint8_t** data)
+    {
+        uintptr_t result = *((const uint32_t*)*data);
+        *data += sizeof(uint32_t);
+        return result;
+    }
+};
+
+template <uint8_t encoding>
+static
+const uint8_t*
+skip_call_sites(const uint8_t* callSitePtr, const uint8_t* callSiteTableEnd,
+                uintptr_t ipOffset)
+{
+    typedef call_site_field<encoding> field;
+    while (callSitePtr < callSiteTableEnd)
+    {
+        const uint8_t* entry = callSitePtr;
+        uintptr_t start = field::read(&callSitePtr);
+        uintptr_t length = field::read(&callSitePtr);
+        if (ipOffset < start + length)
+            return entry;
+        field::read(&callSitePtr);    // landingPad
+        readULEB128(&callSitePtr);    // actionEntry
+    }
+    return callSiteTableEnd;
+}
+
+}  // extern "C++"
+
+/// Skip the call sites that end at or before ipOffset
+/// @returns the entry of the call site containing ipOffset if there is one,
+///          else the first entry after ipOffset, else the end of the table.
+///          Tables in other encodings are left to the walk in scan_eh_tab,
+///          and callSitePtr is returned unchanged.
+static
+const uint8_t*
+skip_call_sites(uint8_t callSiteEncoding, const uint8_t* callSitePtr,
+                const uint8_t* callSiteTableEnd, uintptr_t ipOffset)
+{
+    switch (callSiteEncoding)
+    {
+    case DW_EH_PE_uleb128:
+        return skip_call_sites<DW_EH_PE_uleb128>(callSitePtr, callSiteTableEnd, ipOffset);
+    case DW_EH_PE_udata4:
+        return skip_call_sites<DW_EH_PE_udata4>(callSitePtr, callSiteTableEnd, ipOffset);
+    default:
+        return callSitePtr;
+    }
+}
+#endif  // !__USING_SJLJ_EXCEPTIONS__
+
 /*
     There are 3 types of scans needed:
 
@@ -542,6 +803,8 @@ set_registers(_Unwind_Exception* unwind_exception, _Unwind_Context* context,
 
     3.  Scan for cleanups.  If a handler is found and this isn't forced unwind,
         then terminate, otherwise ignore the handler and keep looking for cleanup.
+        Phase 1 has already matched a native exception against the catch (T)
+        clauses and exception specs, so only catch (...) is checked for that.
         If a cleanup is found, return _URC_HANDLER_FOUND, else return _URC_CONTINUE_UNWIND.
         May also report an error on invalid input.
         May terminate for invalid exception table.
@@ -645,6 +908,23 @@ static void scan_eh_tab(scan_results &results, _Unwind_Action actions,
     const uint8_t* callSiteTableEnd = callSiteTableStart + callSiteTableLength;
     const uint8_t* actionTableStart = callSiteTableEnd;
     const uint8_t* callSitePtr = callSiteTableStart;
+#if !__USING_SJLJ_EXCEPTIONS__ && LIBCXXABI_LSDA_INDEX_SLOTS > 0
+    if (callSiteTableLength >= lsda_index_min_table_length)
+    {
+        // Go straight to the call site for ip rather than walking up to it
+        const lsda_index* index =
+            find_lsda_index(results.languageSpecificData, funcStart,
+                            callSiteEncoding, callSiteTableStart,
+                            callSiteTableLength);
+        if (index != NULL)
+            callSitePtr = lookup_call_site(index, ipOffset, callSiteTableStart);
+    }
+#endif
+#if !__USING_SJLJ_EXCEPTIONS__
+    if (callSitePtr == callSiteTableStart)
+        callSitePtr = skip_call_sites(callSiteEncoding, callSitePtr,
+                                      callSiteTableEnd, ipOffset);
+#endif
     while (callSitePtr < callSiteTableEnd)
     {
         // There is one entry per call site.
@@ -731,8 +1011,10 @@ static void scan_eh_tab(scan_results &results, _Unwind_Action actions,
                         }
                     }
                     // Else this is a catch (T) clause and will never
-                    //    catch a foreign exception
-                    else if (native_exception)
+                    //    catch a foreign exception.  In a type 3 search of a
+                    //    native exception phase 1 has already decided that it
+                    //    does not catch, so skip matching the type again.
+                    else if (native_exception && (actions & _UA_SEARCH_PHASE))
                     {
                         __cxa_exception* exception_header = (__cxa_exception*)(unwind_exception+1) - 1;
                         void* adjustedPtr = get_thrown_object_ptr(unwind_exception);
@@ -772,8 +1054,9 @@ static void scan_eh_tab(scan_results &results, _Unwind_Action actions,
                 else if (ttypeIndex < 0)
                 {
                     // Found an exception spec.  If this is a foreign exception,
-                    //   it is always caught.
-                    if (native_exception)
+                    //   it is always caught.  As with catch (T), a native
+                    //   exception is only matched against it in phase 1.
+                    if (native_exception && (actions & _UA_SEARCH_PHASE))
                     {
                         // Does the exception spec catch this native exception?
                         __cxa_exception* exception_header = (__cxa_exception*)(unwind_exception+1) - 1;
@@ -811,7 +1094,7 @@ static void scan_eh_tab(scan_results &results, _Unwind_Action actions,
                             }
                         }
                     }
-                    else
+                    else if (!native_exception)
                     {
                         // foreign exception caught by exception spec
                         // If this is a type 1 search, save state and return _URC_HANDLER_FOUND
@@ -953,7 +1236,8 @@ __gxx_personality_v0
         scan_eh_tab(results, actions, native_exception, unwind_exception, context);
         if (results.reason == _URC_HANDLER_FOUND)
         {
-            // Found one.  Can we cache the results somewhere to optimize phase 2?
+            // Found one.  Cache the results in the exception header so that
+            //   phase 2 can go straight to the handler without scanning again.
             if (native_exception)
             {
                 __cxa_exception* exception_header = (__cxa_exception*)(unwind_exception+1) - 1;
@@ -1245,7 +1529,7 @@ __cxa_call_unexpected(void* arg)
             // The answer is obviously yes if the new and old exceptions are the same exception
             // If no
             //    throw;
-            __cxa_eh_globals* globals = __cxa_get_globals_fast();
+            __cxa_eh_globals* globals = __get_eh_globals_fast();
             __cxa_exception* new_exception_header = globals->caughtExceptions;
             if (new_exception_header == 0)
                 // This shouldn't be able to happen!
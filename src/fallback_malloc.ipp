@@ -5,23 +5,35 @@
 // This file is dual licensed under the MIT and the University of Illinois Open
 // Source Licenses. See LICENSE.TXT for details.
 //
-//  
+//
 //  This file implements the "Exception Handling APIs"
 //  http://mentorembedded.github.io/cxx-abi/abi-eh.html
-//  
+//
 //===----------------------------------------------------------------------===//
 
 #include "config.h"
 
-//  A small, simple heap manager based (loosely) on 
-//  the startup heap manager from FreeBSD, optimized for space.
+#include <stdint.h>
+#include <stdlib.h>
+
+//  The emergency heap for exception objects, used when malloc fails.
 //
 //  Manages a fixed-size memory pool, supports malloc and free only.
 //  No support for realloc.
 //
-//  Allocates chunks in multiples of four bytes, with a four byte header
-//  for each chunk. The overhead of each chunk is kept low by keeping pointers
-//  as two byte offsets within the heap, rather than (4 or 8 byte) pointers.
+//  The pool is carved into power-of-two sized blocks by a buddy allocator,
+//  with one free list per block size.  Allocation takes the smallest free
+//  block that fits and splits it; freeing merges a block with its buddy for
+//  as long as the buddy is free.  Both are bounded by the number of block
+//  sizes rather than the number of free blocks.  Each block starts with a
+//  header recording its size, so free needs no length.
+//
+//  The pool is LIBCXXABI_FALLBACK_HEAP_SIZE bytes, which can be changed at
+//  startup with the LIBCXXABI_EMERGENCY_POOL_SIZE environment variable.  So
+//  that the first thread to run out of memory cannot take all of it from
+//  the threads that follow, a thread may hold at most an eighth of the pool
+//  (but at least one largest block), which leaves the rest in reserve for
+//  the other threads.
 
 namespace {
 
@@ -49,137 +61,266 @@ private:
 #endif
     };
 
-        
-#define HEAP_SIZE   512
-char heap [ HEAP_SIZE ];
+static const size_t   min_block_size  = 64;
+static const size_t   max_block_order = 6;      // 64 << 6 == 4096 bytes
+static const size_t   max_block_size  = min_block_size << max_block_order;
+static const size_t   max_heap_size   = 0x80000000; // offsets are 32 bits
+static const uint32_t no_block        = ~uint32_t(0);
+
+static_assert(LIBCXXABI_FALLBACK_HEAP_SIZE >= max_block_size,
+              "LIBCXXABI_FALLBACK_HEAP_SIZE must hold at least one block");
+
+//  The header of every block.  It is as aligned as _Unwind_Exception so that
+//  the memory handed out behind it is too.
+struct __attribute__((aligned)) heap_node {
+    uint32_t prev;      // offsets into heap of the neighbours in the free
+    uint32_t next;      //   list, or no_block
+    uint8_t  order;     // the block is ( min_block_size << order ) bytes
+    bool     free;
+    uint16_t owner;     // index into heap_owners while allocated
+};
+
+char default_heap [ LIBCXXABI_FALLBACK_HEAP_SIZE ] __attribute__((aligned));
 
-typedef unsigned short heap_offset;
-typedef unsigned short heap_size;
+char *heap = default_heap;
+size_t heap_size = LIBCXXABI_FALLBACK_HEAP_SIZE / max_block_size * max_block_size;
+size_t heap_used = 0;   // bytes in allocated blocks
+bool heap_initialized = false;
+uint32_t freelist [ max_block_order + 1 ];
 
-struct heap_node {
-    heap_offset next_node;  // offset into heap
-    heap_size   len;        // size in units of "sizeof(heap_node)"
+#if !LIBCXXABI_HAS_NO_THREADS
+//  How much of the heap each thread currently holds.  A slot is in use while
+//  bytes is not zero, and is given back when its blocks have all been freed.
+//  Each thread remembers its slot, and the free slots are kept on a stack,
+//  so finding or claiming one takes no search.  Threads beyond
+//  max_heap_owners are not limited.
+struct heap_owner {
+    pthread_t thread;
+    size_t    bytes;
 };
 
-static const heap_node *list_end = (heap_node *) ( &heap [ HEAP_SIZE ] );   // one past the end of the heap
-static heap_node *freelist = NULL;
+static const uint16_t max_heap_owners = 64;
+static const uint16_t no_owner        = 0xFFFF;
+heap_owner heap_owners [ max_heap_owners ];
+uint16_t free_owners [ max_heap_owners ];
+uint16_t free_owner_count = 0;
+#if LIBCXXABI_HAS_TLS_EH_GLOBALS
+__thread uint16_t thread_owner __attribute__((tls_model("initial-exec"))) = no_owner;
+#else
+__thread uint16_t thread_owner = no_owner;
+#endif
+#endif
+
+heap_node *node_from_offset ( const uint32_t offset )
+    { return (heap_node *) ( heap + offset ); }
+
+uint32_t offset_from_node ( const heap_node *ptr )
+    { return static_cast<uint32_t>(((const char *) ptr ) - heap); }
+
+size_t block_size ( size_t order )
+    { return min_block_size << order; }
+
+void push_free ( heap_node *p ) {
+    p->free = true;
+    p->prev = no_block;
+    p->next = freelist [ p->order ];
+    if ( no_block != p->next )
+        node_from_offset ( p->next )->prev = offset_from_node ( p );
+    freelist [ p->order ] = offset_from_node ( p );
+    }
 
-heap_node *node_from_offset ( const heap_offset offset )
-    { return (heap_node *) ( heap + ( offset * sizeof (heap_node))); }
+void remove_free ( heap_node *p ) {
+    if ( no_block != p->prev )
+        node_from_offset ( p->prev )->next = p->next;
+    else
+        freelist [ p->order ] = p->next;
+    if ( no_block != p->next )
+        node_from_offset ( p->next )->prev = p->prev;
+    p->free = false;
+    }
 
-heap_offset offset_from_node ( const heap_node *ptr )
-    { return static_cast<heap_offset>(static_cast<size_t>(((char *) ptr ) - heap)  / sizeof (heap_node)); }
- 
 void init_heap () {
-    freelist = (heap_node *) heap;
-    freelist->next_node = offset_from_node ( list_end );
-    freelist->len = HEAP_SIZE / sizeof (heap_node);
+    for ( size_t order = 0; order <= max_block_order; ++order )
+        freelist [ order ] = no_block;
+    for ( size_t offset = heap_size; offset >= max_block_size; ) {
+        offset -= max_block_size;
+        heap_node *p = node_from_offset ( static_cast<uint32_t>(offset));
+        p->order = max_block_order;
+        push_free ( p );
+        }
+#if !LIBCXXABI_HAS_NO_THREADS
+    for ( uint16_t i = 0; i < max_heap_owners; ++i ) {
+        heap_owners [ i ].bytes = 0;
+        free_owners [ i ] = static_cast<uint16_t>(max_heap_owners - 1 - i);
+        }
+    free_owner_count = max_heap_owners;
+#endif
+    heap_used = 0;
+    heap_initialized = true;
+    }
+
+//  Picks the size of the pool before anything can run out of memory.  A
+//  larger pool than the built-in one is allocated here, while malloc works.
+//  If another constructor has already taken blocks from the pool, it is
+//  left as it is.
+__attribute__((constructor))
+void init_heap_size () {
+#if !LIBCXXABI_BAREMETAL
+    const char *env = getenv ( "LIBCXXABI_EMERGENCY_POOL_SIZE" );
+    if ( NULL != env ) {
+        size_t size = static_cast<size_t>(strtoul ( env, NULL, 0 ));
+        if ( size > max_heap_size )
+            size = max_heap_size;
+        size = size / max_block_size * max_block_size;
+        mutexor mtx ( &heap_mutex );
+        if ( 0 != heap_used )
+            return;
+        if ( size > heap_size ) {
+            char *p = static_cast<char *>(malloc ( size ));
+            if ( NULL != p ) {
+                heap = p;
+                heap_size = size;
+                }
+            }
+        else if ( size >= max_block_size )
+            heap_size = size;
+        init_heap ();
+        }
+#endif
+    }
+
+//  The order of the smallest block that holds len bytes plus its header
+size_t alloc_order ( size_t len ) {
+    size_t order = 0;
+    while ( order <= max_block_order && block_size ( order ) - sizeof(heap_node) < len )
+        ++order;
+    return order;
     }
-    
-//  How big a chunk we allocate
-size_t alloc_size (size_t len)
-    { return (len + sizeof(heap_node) - 1) / sizeof(heap_node) + 1; }
 
 bool is_fallback_ptr ( void *ptr )
-    { return ptr >= heap && ptr < ( heap + HEAP_SIZE ); }
+    { return ptr >= heap && ptr < ( heap + heap_size ); }
+
+#if !LIBCXXABI_HAS_NO_THREADS
+//  Returns the slot of the calling thread, or no_owner if it holds nothing.
+//  The slot it remembers may since have been given back and claimed by
+//  another thread.
+uint16_t find_owner () {
+    const uint16_t i = thread_owner;
+    if ( no_owner != i && 0 != heap_owners [ i ].bytes &&
+         pthread_equal ( heap_owners [ i ].thread, pthread_self ()))
+        return i;
+    return no_owner;
+    }
+
+//  Claims a free slot for the calling thread, or returns no_owner if all
+//  slots are taken.
+uint16_t claim_owner () {
+    if ( 0 == free_owner_count )
+        return no_owner;
+    const uint16_t i = free_owners [ --free_owner_count ];
+    heap_owners [ i ].thread = pthread_self ();
+    thread_owner = i;
+    return i;
+    }
+
+//  Whether a thread holding owner's share may take size more bytes.
+bool within_share ( uint16_t owner, size_t size ) {
+    size_t limit = heap_size / 8;
+    if ( limit < max_block_size )
+        limit = max_block_size;
+    const size_t held = no_owner != owner ? heap_owners [ owner ].bytes : 0;
+    return held + size <= limit;
+    }
+#endif
 
 void *fallback_malloc(size_t len) {
-    heap_node *p, *prev;
-    const size_t nelems = alloc_size ( len );
+    const size_t order = alloc_order ( len );
+    if ( order > max_block_order )
+        return NULL;
     mutexor mtx ( &heap_mutex );
-    
-    if ( NULL == freelist )
+
+    if ( !heap_initialized )
         init_heap ();
 
-//  Walk the free list, looking for a "big enough" chunk
-    for (p = freelist, prev = 0; 
-            p && p != list_end;     prev = p, p = node_from_offset ( p->next_node)) {
-
-        if (p->len > nelems) {  //  chunk is larger, shorten, and return the tail
-            heap_node *q;
-            
-            p->len -= nelems;
-            q = p + p->len;
-            q->next_node = 0;
-            q->len = static_cast<heap_size>(nelems);
-            return (void *) (q + 1);
-        }
-        
-        if (p->len == nelems) { // exact size match
-            if (prev == 0)
-                freelist = node_from_offset(p->next_node);
-            else
-                prev->next_node = p->next_node;
-            p->next_node = 0;
-            return (void *) (p + 1);
+#if !LIBCXXABI_HAS_NO_THREADS
+    uint16_t owner = find_owner ();
+    if ( !within_share ( owner, block_size ( order )))
+        return NULL;    // this thread has used up its share
+#endif
+
+//  Take the smallest free block that is big enough
+    size_t k = order;
+    while ( k <= max_block_order && no_block == freelist [ k ] )
+        ++k;
+    if ( k > max_block_order )
+        return NULL;    // couldn't find a spot big enough
+    heap_node *p = node_from_offset ( freelist [ k ] );
+    remove_free ( p );
+
+//  Split it, returning the upper halves to the free lists
+    while ( k > order ) {
+        --k;
+        heap_node *buddy = (heap_node *) ((char *) p + block_size ( k ));
+        buddy->order = static_cast<uint8_t>(k);
+        push_free ( buddy );
         }
-    }
-    return NULL;    // couldn't find a spot big enough
-}
+    p->order = static_cast<uint8_t>(order);
 
-//  Return the start of the next block
-heap_node *after ( struct heap_node *p ) { return p + p->len; }
+#if !LIBCXXABI_HAS_NO_THREADS
+    if ( no_owner == owner )
+        owner = claim_owner ();
+    p->owner = owner;
+    if ( no_owner != owner )
+        heap_owners [ owner ].bytes += block_size ( order );
+#endif
+    heap_used += block_size ( order );
+    return (void *) (p + 1);
+}
 
 void fallback_free (void *ptr) {
-    struct heap_node *cp = ((struct heap_node *) ptr) - 1;      // retrieve the chunk
-    struct heap_node *p, *prev;
+    heap_node *cp = ((heap_node *) ptr) - 1;      // retrieve the chunk
 
     mutexor mtx ( &heap_mutex );
 
-#ifdef DEBUG_FALLBACK_MALLOC
-        std::cout << "Freeing item at " << offset_from_node ( cp ) << " of size " << cp->len << std::endl;
+#if !LIBCXXABI_HAS_NO_THREADS
+    if ( no_owner != cp->owner ) {
+        heap_owners [ cp->owner ].bytes -= block_size ( cp->order );
+        if ( 0 == heap_owners [ cp->owner ].bytes )
+            free_owners [ free_owner_count++ ] = cp->owner;
+        }
 #endif
+    heap_used -= block_size ( cp->order );
 
-    for (p = freelist, prev = 0; 
-            p && p != list_end;     prev = p, p = node_from_offset (p->next_node)) {
-#ifdef DEBUG_FALLBACK_MALLOC
-        std::cout << "  p, cp, after (p), after(cp) "
-            << offset_from_node ( p ) << ' '
-            << offset_from_node ( cp ) << ' '
-            << offset_from_node ( after ( p )) << ' '
-            << offset_from_node ( after ( cp )) << std::endl;
-#endif
-        if ( after ( p ) == cp ) {
-#ifdef DEBUG_FALLBACK_MALLOC
-            std::cout << "  Appending onto chunk at " << offset_from_node ( p ) << std::endl;
-#endif
-            p->len += cp->len;  // make the free heap_node larger
-            return;
-            }
-        else if ( after ( cp ) == p ) { // there's a free heap_node right after
-#ifdef DEBUG_FALLBACK_MALLOC
-            std::cout << "  Appending free chunk at " << offset_from_node ( p ) << std::endl;
-#endif
-            cp->len += p->len;
-            if ( prev == 0 ) {
-                freelist = cp;
-                cp->next_node = p->next_node;
-                }
-            else
-                prev->next_node = offset_from_node(cp);
-            return;
-            }
+//  Merge with the buddy for as long as it is free and whole
+    size_t order = cp->order;
+    while ( order < max_block_order ) {
+        heap_node *buddy = node_from_offset (
+            offset_from_node ( cp ) ^ static_cast<uint32_t>(block_size ( order )));
+        if ( !buddy->free || buddy->order != order )
+            break;
+        remove_free ( buddy );
+        if ( buddy < cp )
+            cp = buddy;
+        ++order;
         }
-//  Nothing to merge with, add it to the start of the free list
-#ifdef DEBUG_FALLBACK_MALLOC
-            std::cout << "  Making new free list entry " << offset_from_node ( cp ) << std::endl;
-#endif
-    cp->next_node = offset_from_node ( freelist );
-    freelist = cp;
+    cp->order = static_cast<uint8_t>(order);
+    push_free ( cp );
 }
 
 #ifdef INSTRUMENT_FALLBACK_MALLOC
 size_t print_free_list () {
-    struct heap_node *p, *prev;
-    heap_size total_free = 0;
-    if ( NULL == freelist )
+    size_t total_free = 0;
+    if ( !heap_initialized )
         init_heap ();
-    
-    for (p = freelist, prev = 0; 
-            p && p != list_end;     prev = p, p = node_from_offset (p->next_node)) {
-        std::cout << ( prev == 0 ? "" : "  ")  << "Offset: " << offset_from_node ( p ) 
-                << "\tsize: " << p->len << " Next: " << p->next_node << std::endl;
-        total_free += p->len;
+
+    for ( size_t order = 0; order <= max_block_order; ++order ) {
+        size_t count = 0;
+        for ( uint32_t offset = freelist [ order ]; offset != no_block;
+                offset = node_from_offset ( offset )->next )
+            ++count;
+        if ( count > 0 )
+            std::cout << "Size: " << block_size ( order ) << "\tfree blocks: " << count << std::endl;
+        total_free += count * block_size ( order );
         }
     std::cout << "Total Free space: " << total_free << std::endl;
     return total_free;
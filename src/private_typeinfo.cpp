@@ -8,6 +8,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "private_typeinfo.h"
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
 
 // The flag _LIBCXX_DYNAMIC_FALLBACK is used to make dynamic_cast more
 // forgiving when type_info's mistakenly have hidden visibility and thus
@@ -57,6 +61,12 @@ namespace __cxxabiv1
 
 #pragma GCC visibility push(hidden)
 
+#if _LIBCXX_DYNAMIC_FALLBACK || defined(_WIN32)
+
+#include "type_name_table.ipp"
+
+#endif  // _LIBCXX_DYNAMIC_FALLBACK || defined(_WIN32)
+
 #if _LIBCXX_DYNAMIC_FALLBACK
 
 inline
@@ -65,7 +75,7 @@ is_equal(const std::type_info* x, const std::type_info* y, bool use_strcmp)
 {
     if (!use_strcmp)
         return x == y;
-    return strcmp(x->name(), y->name()) == 0;
+    return x == y || is_same_type_name(x, y);
 }
 
 #else  // !_LIBCXX_DYNAMIC_FALLBACK
@@ -77,7 +87,7 @@ is_equal(const std::type_info* x, const std::type_info* y, bool)
 #ifndef _WIN32
     return x == y;
 #else
-    return (x == y) || (strcmp(x->name(), y->name()) == 0);
+    return (x == y) || is_same_type_name(x, y);
 #endif    
 }
 
@@ -156,6 +166,76 @@ __pointer_to_member_type_info::~__pointer_to_member_type_info()
 {
 }
 
+// offset_cache
+
+// A fixed-size, direct-mapped cache from a key of KeyWords words to an
+// offset, shared by all threads without a lock.  Only the first HashWords
+// words of the key pick its slot; the rest only have to match.  An entry is overwritten
+// when its slot is needed for another key.  Each entry is guarded by a
+// sequence number that is odd while the entry is being written; a reader
+// that sees it odd, or changed by the time it has read the entry, treats the
+// lookup as a miss, and a writer that finds it odd gives up.
+//
+// It has no constructor so that a static one is zero-initialized, with no
+// constructor to run before it can be used.
+
+static const ptrdiff_t no_cached_offset = PTRDIFF_MIN;
+
+template <size_t KeyWords, size_t Size, size_t HashWords = KeyWords>
+struct offset_cache
+{
+    struct entry
+    {
+        unsigned  sequence;
+        uintptr_t key[KeyWords];
+        ptrdiff_t offset;
+    };
+
+    entry entries[Size];
+
+    // The words are combined with rotates, which are quick to chain, and
+    //   mixed with a single multiply at the end.
+    entry& slot(const uintptr_t* key)
+    {
+        const unsigned bits = sizeof(uintptr_t) * 8;
+        uintptr_t hash = 0;
+        for (size_t i = 0; i < HashWords; ++i)
+            hash = ((hash << 7) | (hash >> (bits - 7))) ^ key[i];
+        hash *= 2654435761U;
+        hash ^= hash >> 15;
+        return entries[hash % Size];
+    }
+
+    bool lookup(const uintptr_t* key, ptrdiff_t& offset)
+    {
+        entry& e = slot(key);
+        unsigned sequence = __atomic_load_n(&e.sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1)
+            return false;
+        bool hit = true;
+        for (size_t i = 0; i < KeyWords; ++i)
+            hit &= __atomic_load_n(&e.key[i], __ATOMIC_RELAXED) == key[i];
+        offset = __atomic_load_n(&e.offset, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return hit && __atomic_load_n(&e.sequence, __ATOMIC_RELAXED) == sequence;
+    }
+
+    void insert(const uintptr_t* key, ptrdiff_t offset)
+    {
+        entry& e = slot(key);
+        unsigned sequence = __atomic_load_n(&e.sequence, __ATOMIC_RELAXED);
+        if ((sequence & 1) ||
+            !__atomic_compare_exchange_n(&e.sequence, &sequence, sequence + 1,
+                                         false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for (size_t i = 0; i < KeyWords; ++i)
+            __atomic_store_n(&e.key[i], key[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&e.offset, offset, __ATOMIC_RELAXED);
+        __atomic_store_n(&e.sequence, sequence + 2, __ATOMIC_RELEASE);
+    }
+};
+
 // can_catch
 
 // A handler is a match for an exception object of type E if
@@ -219,9 +299,383 @@ __enum_type_info::can_catch(const __shim_type_info* thrown_type,
     return is_equal(this, thrown_type, false);
 }
 
+// base tables
+
+#if LIBCXXABI_BASE_TABLE_SLOTS > 0
+
+// A flattened list of every base class subobject of a class with several
+// bases, built the first time it is needed so that finding a base is a scan
+// of the list instead of a recursive walk of the type_infos, which visits a
+// virtual base once for every path to it.
+//
+// Each entry records its type, the entry of a class it is a direct base of,
+// and how to get from that class to it, as in __base_class_type_info.  A
+// virtual base has a single entry however many paths lead to it.  Its
+// address is computed from the object at each use, through the vtables, so
+// it is right for objects under construction too.  Each entry also records
+// whether the most public path to it from the most derived class is public.
+//
+// Tables are published with a compare-and-swap into a fixed number of slots
+// and never freed.  Classes with more than max_flat_bases bases get an empty
+// table so that no one tries to build it again, and are searched as before,
+// as are all classes once the slots are full.
+
+static const unsigned max_flat_bases = 64;
+
+struct flat_base
+{
+    const __class_type_info* type;
+    long                     offset_flags;
+    unsigned                 derived;
+    bool                     is_public;
+};
+
+struct flat_base_table
+{
+    const __class_type_info* type;
+    const char*              name;
+    unsigned                 count;
+    flat_base                bases[1];
+};
+
+static flat_base_table* base_tables[LIBCXXABI_BASE_TABLE_SLOTS];
+
+// A class whose table is not within this many slots of its hash has none,
+//   so that looking for it stays cheap once base_tables is full.
+static const size_t max_base_table_probes = 16;
+
+class flat_base_builder
+{
+    struct edge
+    {
+        unsigned base;
+        unsigned derived;
+        bool     is_public;
+    };
+
+    flat_base bases_[max_flat_bases];
+    edge      edges_[2 * max_flat_bases];
+    unsigned  count_;
+    unsigned  edge_count_;
+    bool      overflow_;
+
+    unsigned add(const __class_type_info* type, unsigned derived, long offset_flags)
+    {
+        if (count_ == max_flat_bases)
+        {
+            overflow_ = true;
+            return 0;
+        }
+        flat_base& base = bases_[count_];
+        base.type = type;
+        base.offset_flags = offset_flags;
+        base.derived = derived;
+        base.is_public = false;
+        return count_++;
+    }
+
+    void add_edge(unsigned base, unsigned derived, long offset_flags)
+    {
+        if (edge_count_ == 2 * max_flat_bases)
+        {
+            overflow_ = true;
+            return;
+        }
+        edge& e = edges_[edge_count_++];
+        e.base = base;
+        e.derived = derived;
+        e.is_public = (offset_flags & __base_class_type_info::__public_mask) != 0;
+    }
+
+    void add_bases_of(unsigned derived)
+    {
+        if (overflow_)
+            return;
+        const __class_type_info* type = bases_[derived].type;
+        if (is_equal(&typeid(*type), &typeid(__si_class_type_info), false))
+        {
+            const __si_class_type_info* si_type =
+                static_cast<const __si_class_type_info*>(type);
+            long offset_flags = __base_class_type_info::__public_mask;
+            unsigned base = add(si_type->__base_type, derived, offset_flags);
+            add_edge(base, derived, offset_flags);
+            add_bases_of(base);
+        }
+        else if (is_equal(&typeid(*type), &typeid(__vmi_class_type_info), false))
+        {
+            const __vmi_class_type_info* vmi_type =
+                static_cast<const __vmi_class_type_info*>(type);
+            for (unsigned i = 0; i < vmi_type->__base_count && !overflow_; ++i)
+            {
+                const __base_class_type_info& info = vmi_type->__base_info[i];
+                if (info.__offset_flags & __base_class_type_info::__virtual_mask)
+                {
+                    // A virtual base already found through another path
+                    //   is the same subobject.
+                    unsigned j = 1;
+                    while (j < count_ && !(bases_[j].type == info.__base_type &&
+                                          (bases_[j].offset_flags & __base_class_type_info::__virtual_mask)))
+                        ++j;
+                    if (j < count_)
+                    {
+                        add_edge(j, derived, info.__offset_flags);
+                        continue;
+                    }
+                }
+                unsigned base = add(info.__base_type, derived, info.__offset_flags);
+                add_edge(base, derived, info.__offset_flags);
+                add_bases_of(base);
+            }
+        }
+    }
+
+public:
+    flat_base_table* build(const __class_type_info* type)
+    {
+        count_ = 0;
+        edge_count_ = 0;
+        overflow_ = false;
+        add(type, 0, __base_class_type_info::__public_mask);
+        add_bases_of(0);
+        if (overflow_)
+            count_ = 0;
+        // Find the most public path to each base.  A virtual base may be
+        //   reached from a class found after it, so repeat until nothing
+        //   changes.
+        if (count_ != 0)
+            bases_[0].is_public = true;
+        for (bool changed = true; changed && count_ != 0;)
+        {
+            changed = false;
+            for (unsigned i = 0; i < edge_count_; ++i)
+            {
+                const edge& e = edges_[i];
+                if (!bases_[e.base].is_public && bases_[e.derived].is_public && e.is_public)
+                    changed = bases_[e.base].is_public = true;
+            }
+        }
+        flat_base_table* table = static_cast<flat_base_table*>(
+            malloc(sizeof(flat_base_table) + count_ * sizeof(flat_base)));
+        if (table == NULL)
+            return NULL;
+        table->type = type;
+        table->name = type->name();
+        table->count = count_;
+        for (unsigned i = 0; i < count_; ++i)
+            table->bases[i] = bases_[i];
+        return table;
+    }
+};
+
+/// @returns the base table of type, or null if it has none
+static
+const flat_base_table*
+get_base_table(const __class_type_info* type)
+{
+    // Only classes with several bases have tables.  This is called from
+    //   __dynamic_cast, so it must not use dynamic_cast itself.
+    if (!is_equal(&typeid(*type), &typeid(__vmi_class_type_info), false))
+        return NULL;
+    flat_base_table* built = NULL;
+    size_t hash = (reinterpret_cast<uintptr_t>(type) >> 3) * 2654435761U;
+    for (size_t i = 0; i < max_base_table_probes; ++i)
+    {
+        flat_base_table** slot = &base_tables[(hash + i) % LIBCXXABI_BASE_TABLE_SLOTS];
+        flat_base_table* table = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (table == NULL)
+        {
+            if (built == NULL)
+            {
+                flat_base_builder builder;
+                built = builder.build(type);
+            }
+            if (built == NULL)
+                return NULL;
+            if (__atomic_compare_exchange_n(slot, &table, built, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return built->count != 0 ? built : NULL;
+        }
+        // The name is checked too in case a library was unloaded and another
+        //   type_info now lives at the same address.
+        if (table->type == type && table->name == type->name())
+        {
+            free(built);
+            return table->count != 0 ? table : NULL;
+        }
+    }
+    free(built);
+    return NULL;
+}
+
+/// Compute the address of base i of the object whose earlier bases are at
+/// addresses
+static
+const char*
+get_base_address(const flat_base_table* table, unsigned i,
+                 const char* const* addresses)
+{
+    const flat_base& base = table->bases[i];
+    const char* derived = addresses[base.derived];
+    ptrdiff_t offset = base.offset_flags >> __base_class_type_info::__offset_shift;
+    if (base.offset_flags & __base_class_type_info::__virtual_mask)
+    {
+        const char* vtable = *reinterpret_cast<const char* const*>(derived);
+        offset = *reinterpret_cast<const ptrdiff_t*>(vtable + offset);
+    }
+    return derived + offset;
+}
+
+/// Look for the base (base_ptr, base_type) of the object at ptr
+/// @returns unknown if there is none, else whether the most public path
+///          to it is public_path or not_public_path
+static
+int
+find_flat_base(const flat_base_table* table, const void* ptr,
+               const __class_type_info* base_type, const void* base_ptr)
+{
+    // A (pointer, type) pair has only one entry, so stop at the first match
+    const char* addresses[max_flat_bases];
+    addresses[0] = static_cast<const char*>(ptr);
+    for (unsigned i = 0; i < table->count; ++i)
+    {
+        if (i != 0)
+            addresses[i] = get_base_address(table, i, addresses);
+        if (addresses[i] == base_ptr && is_equal(table->bases[i].type, base_type, false))
+            return table->bases[i].is_public ? public_path : not_public_path;
+    }
+    return unknown;
+}
+
+/// Look for base_type as an unambiguous public base of the object at ptr
+/// @returns a pointer to it, or null if there is none
+static
+const void*
+find_unique_flat_base(const flat_base_table* table, const void* ptr,
+                      const __class_type_info* base_type)
+{
+    const char* addresses[max_flat_bases];
+    addresses[0] = static_cast<const char*>(ptr);
+    const char* found = 0;
+    bool is_public = false;
+    for (unsigned i = 0; i < table->count; ++i)
+    {
+        if (i != 0)
+            addresses[i] = get_base_address(table, i, addresses);
+        if (!is_equal(table->bases[i].type, base_type, false))
+            continue;
+        if (found != 0 && found != addresses[i])
+            return 0;    // ambiguous
+        found = addresses[i];
+        is_public |= table->bases[i].is_public;
+    }
+    return is_public ? found : 0;
+}
+
+#endif  // LIBCXXABI_BASE_TABLE_SLOTS > 0
+
+#if LIBCXXABI_CATCH_CACHE_SIZE > 0
+
+// The results of looking for a catch class type among the bases of a thrown
+// class type, keyed by the two types, so that throwing the same type through
+// the same handlers walks the hierarchy only once.  The offset of the catch
+// type in the thrown object is recorded, or no_cached_offset if it is not an
+// unambiguous public base.  The key also holds the names of the two types,
+// which are not hashed, in case a library was unloaded and another now has
+// its type_info's at the same addresses.
+static offset_cache<4, LIBCXXABI_CATCH_CACHE_SIZE, 2> catch_cache;
+
+// Whether a class has a virtual base anywhere in its hierarchy, which makes
+// the offset of its bases depend on the most derived object.
+static
+bool
+has_virtual_base(const __class_type_info* type)
+{
+    if (const __si_class_type_info* si_type =
+            dynamic_cast<const __si_class_type_info*>(type))
+        return has_virtual_base(si_type->__base_type);
+    if (const __vmi_class_type_info* vmi_type =
+            dynamic_cast<const __vmi_class_type_info*>(type))
+    {
+        for (unsigned i = 0; i < vmi_type->__base_count; ++i)
+        {
+            const __base_class_type_info& base = vmi_type->__base_info[i];
+            if ((base.__offset_flags & __base_class_type_info::__virtual_mask) ||
+                has_virtual_base(base.__base_type))
+                return true;
+        }
+    }
+    return false;
+}
+
+#endif  // LIBCXXABI_CATCH_CACHE_SIZE > 0
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wmissing-field-initializers"
 
+// Looks for catch_type as an unambiguous public base of thrown_type, and if
+// it is one, points adjustedPtr at it.  complete_object says whether
+// adjustedPtr is known to point to a complete thrown_type, as the exception
+// object does, rather than to a base of some more derived object, as a
+// thrown pointer may.
+static
+bool
+find_unambiguous_public_base(const __class_type_info* thrown_type,
+                             const __class_type_info* catch_type,
+                             void*& adjustedPtr, bool complete_object)
+{
+#if LIBCXXABI_CATCH_CACHE_SIZE > 0
+    // A null pointer has no bases to adjust to and can't be checked for
+    // ambiguity, so it is never cached.
+    const uintptr_t key[] = {reinterpret_cast<uintptr_t>(thrown_type),
+                             reinterpret_cast<uintptr_t>(catch_type),
+                             reinterpret_cast<uintptr_t>(thrown_type->name()),
+                             reinterpret_cast<uintptr_t>(catch_type->name())};
+    ptrdiff_t offset;
+    if (adjustedPtr != NULL && catch_cache.lookup(key, offset))
+    {
+        if (offset == no_cached_offset)
+            return false;
+        adjustedPtr = static_cast<char*>(adjustedPtr) + offset;
+        return true;
+    }
+#endif
+    __dynamic_cast_info info = {thrown_type, 0, catch_type, -1, 0};
+    info.number_of_dst_type = 1;
+    bool searched = false;
+#if LIBCXXABI_BASE_TABLE_SLOTS > 0
+    const flat_base_table* table = adjustedPtr != NULL ? get_base_table(thrown_type) : NULL;
+    if (table != NULL)
+    {
+        info.dst_ptr_leading_to_static_ptr =
+            find_unique_flat_base(table, adjustedPtr, catch_type);
+        if (info.dst_ptr_leading_to_static_ptr != 0)
+            info.path_dst_ptr_to_static_ptr = public_path;
+        searched = true;
+    }
+#endif
+    if (!searched)
+        thrown_type->has_unambiguous_public_base(&info, adjustedPtr, public_path);
+    bool found = info.path_dst_ptr_to_static_ptr == public_path;
+#if LIBCXXABI_CATCH_CACHE_SIZE > 0
+    // Whether there is a match depends only on the types, but the offset
+    //   of a virtual base depends on the object unless it is complete.
+    if (adjustedPtr != NULL)
+    {
+        if (!found)
+            catch_cache.insert(key, no_cached_offset);
+        else if (complete_object || !has_virtual_base(thrown_type))
+            catch_cache.insert(key,
+                static_cast<const char*>(info.dst_ptr_leading_to_static_ptr) -
+                static_cast<const char*>(adjustedPtr));
+    }
+#endif
+    if (found)
+        adjustedPtr = const_cast<void*>(info.dst_ptr_leading_to_static_ptr);
+    return found;
+}
+
+#pragma clang diagnostic pop
+
 // Handles bullets 1 and 2
 bool
 __class_type_info::can_catch(const __shim_type_info* thrown_type,
@@ -235,19 +689,9 @@ __class_type_info::can_catch(const __shim_type_info* thrown_type,
     if (thrown_class_type == 0)
         return false;
     // bullet 2
-    __dynamic_cast_info info = {thrown_class_type, 0, this, -1, 0};
-    info.number_of_dst_type = 1;
-    thrown_class_type->has_unambiguous_public_base(&info, adjustedPtr, public_path);
-    if (info.path_dst_ptr_to_static_ptr == public_path)
-    {
-        adjustedPtr = const_cast<void*>(info.dst_ptr_leading_to_static_ptr);
-        return true;
-    }
-    return false;
+    return find_unambiguous_public_base(thrown_class_type, this, adjustedPtr, true);
 }
 
-#pragma clang diagnostic pop
-
 void
 __class_type_info::process_found_base_class(__dynamic_cast_info* info,
                                                void* adjustedPtr,
@@ -276,6 +720,25 @@ __class_type_info::process_found_base_class(__dynamic_cast_info* info,
     }
 }
 
+// Follows the __base_type links of a chain of single inheritance starting at
+//   type, and returns the first class that is t1, t2, or not an
+//   __si_class_type_info.  A leaf __class_type_info ends the chain, and a
+//   __vmi_class_type_info hands it over to the general algorithm.  The
+//   __si_class_type_info searches use this to cover a deep chain in a loop
+//   instead of with one virtual call per level.
+static
+const __class_type_info*
+skip_single_inheritance(const __class_type_info* type,
+                        const __class_type_info* t1,
+                        const __class_type_info* t2,
+                        bool use_strcmp)
+{
+    while (!is_equal(type, t1, use_strcmp) && !is_equal(type, t2, use_strcmp) &&
+           is_equal(&typeid(*type), &typeid(__si_class_type_info), false))
+        type = static_cast<const __si_class_type_info*>(type)->__base_type;
+    return type;
+}
+
 void
 __class_type_info::has_unambiguous_public_base(__dynamic_cast_info* info,
                                                void* adjustedPtr,
@@ -293,7 +756,9 @@ __si_class_type_info::has_unambiguous_public_base(__dynamic_cast_info* info,
     if (is_equal(this, info->static_type, false))
         process_found_base_class(info, adjustedPtr, path_below);
     else
-        __base_type->has_unambiguous_public_base(info, adjustedPtr, path_below);
+        skip_single_inheritance(__base_type, info->static_type,
+                                info->static_type, false)
+            ->has_unambiguous_public_base(info, adjustedPtr, path_below);
 }
 
 void
@@ -352,9 +817,6 @@ __pbase_type_info::can_catch(const __shim_type_info* thrown_type,
     return is_equal(thrown_type, &typeid(std::nullptr_t), false);
 }
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wmissing-field-initializers"
-
 // Handles bullets 1, 3 and 4
 bool
 __pointer_type_info::can_catch(const __shim_type_info* thrown_type,
@@ -387,20 +849,10 @@ __pointer_type_info::can_catch(const __shim_type_info* thrown_type,
         dynamic_cast<const __class_type_info*>(thrown_pointer_type->__pointee);
     if (thrown_class_type == 0)
         return false;
-    __dynamic_cast_info info = {thrown_class_type, 0, catch_class_type, -1, 0};
-    info.number_of_dst_type = 1;
-    thrown_class_type->has_unambiguous_public_base(&info, adjustedPtr, public_path);
-    if (info.path_dst_ptr_to_static_ptr == public_path)
-    {
-        if (adjustedPtr != NULL)
-            adjustedPtr = const_cast<void*>(info.dst_ptr_leading_to_static_ptr);
-        return true;
-    }
-    return false;
+    return find_unambiguous_public_base(thrown_class_type, catch_class_type,
+                                        adjustedPtr, false);
 }
 
-#pragma clang diagnostic pop
-
 #pragma GCC visibility pop
 #pragma GCC visibility push(default)
 
@@ -409,6 +861,43 @@ __pointer_type_info::can_catch(const __shim_type_info* thrown_type,
 
 // __dynamic_cast
 
+// src2dst_offset >= 0 says that static_type is a unique public nonvirtual
+// base of dst_type, at that offset.  So if static_ptr is a base of a dst_type
+// at all, that dst_type is at static_ptr - src2dst_offset, and a downcast
+// only has to check that there is a dst_type there, which is a search of the
+// bases of dynamic_type for it rather than the full search.
+//
+// Returns a pointer to the dst_type, or nullptr if there isn't one there.
+// The cast may still succeed as a cross cast then.
+static
+const void*
+downcast_with_hint(const void* static_ptr, std::ptrdiff_t src2dst_offset,
+                   const __class_type_info* dst_type, const void* dynamic_ptr,
+                   const __class_type_info* dynamic_type)
+{
+    const char* dst_ptr = static_cast<const char*>(static_ptr) - src2dst_offset;
+    if (dst_ptr < static_cast<const char*>(dynamic_ptr))
+        return 0;
+#if LIBCXXABI_BASE_TABLE_SLOTS > 0
+    if (const flat_base_table* table = get_base_table(dynamic_type))
+        return find_flat_base(table, dynamic_ptr, dst_type, dst_ptr) != unknown ? dst_ptr : 0;
+#endif
+    // Look for (dst_ptr, dst_type) above (dynamic_ptr, dynamic_type)
+    __dynamic_cast_info info = {dynamic_type, dst_ptr, dst_type, -1, 0};
+    info.number_of_dst_type = 1;
+    dynamic_type->search_above_dst(&info, dynamic_ptr, dynamic_ptr, public_path, false);
+    if (info.path_dst_ptr_to_static_ptr == unknown)
+        return 0;
+    return dst_ptr;
+}
+
+#if LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE > 0
+// The results of __dynamic_cast, as the offset of the result in the dynamic
+// object or no_cached_offset for a null result.  See __dynamic_cast for the
+// key.
+static offset_cache<7, LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE, 4> dynamic_cast_cache;
+#endif
+
 // static_ptr: pointer to an object of type static_type; nonnull, and since the
 //   object is polymorphic, *(void**)static_ptr is a virtual table pointer.
 //   static_ptr is &v in the expression dynamic_cast<T>(v).
@@ -488,8 +977,8 @@ __dynamic_cast(const void* static_ptr,
                const __class_type_info* dst_type,
                std::ptrdiff_t src2dst_offset)
 {
-    // Possible future optimization:  Take advantage of src2dst_offset
-    // Currently clang always sets src2dst_offset to -1 (no hint).
+    // src2dst_offset is used where it can decide the cast without the full
+    //   search, see downcast_with_hint.
 
     // Get (dynamic_ptr, dynamic_type) from static_ptr
     void** vtable = *(void***)static_ptr;
@@ -497,6 +986,35 @@ __dynamic_cast(const void* static_ptr,
     const void* dynamic_ptr = static_cast<const char*>(static_ptr) + offset_to_derived;
     const __class_type_info* dynamic_type = static_cast<const __class_type_info*>(vtable[-1]);
 
+    // static_ptr is the unique public static_type of dynamic_type.  This is
+    //   cheaper to check than the cache.
+    if (is_equal(dynamic_type, dst_type, false) && src2dst_offset >= 0 &&
+        static_cast<const char*>(static_ptr) - src2dst_offset ==
+        static_cast<const char*>(dynamic_ptr))
+        return const_cast<void*>(dynamic_ptr);
+
+#if LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE > 0
+    // The vtable fixes the layout of the dynamic object, and offset_to_derived
+    //   which subobject static_ptr is, so together with the two types they
+    //   determine the answer.  The names of the three types are checked too
+    //   in case a library was unloaded and another now has its vtable or
+    //   type_info's at the same addresses.
+    const uintptr_t key[] = {reinterpret_cast<uintptr_t>(vtable),
+                             reinterpret_cast<uintptr_t>(static_type),
+                             reinterpret_cast<uintptr_t>(dst_type),
+                             static_cast<uintptr_t>(offset_to_derived),
+                             reinterpret_cast<uintptr_t>(dynamic_type->name()),
+                             reinterpret_cast<uintptr_t>(static_type->name()),
+                             reinterpret_cast<uintptr_t>(dst_type->name())};
+    ptrdiff_t dst_offset;
+    if (dynamic_cast_cache.lookup(key, dst_offset))
+    {
+        if (dst_offset == no_cached_offset)
+            return 0;
+        return const_cast<char*>(static_cast<const char*>(dynamic_ptr) + dst_offset);
+    }
+#endif
+
     // Initialize answer to nullptr.  This will be changed from the search
     //    results if a non-null answer is found.  Regardless, this is what will
     //    be returned.
@@ -505,12 +1023,26 @@ __dynamic_cast(const void* static_ptr,
     __dynamic_cast_info info = {dst_type, static_ptr, static_type, src2dst_offset, 0};
 
     // Find out if we can use a giant short cut in the search
-    if (is_equal(dynamic_type, dst_type, false))
+    if (is_equal(dynamic_type, dst_type, false) && src2dst_offset == -2)
     {
-        // Using giant short cut.  Add that information to info.
-        info.number_of_dst_type = 1;
-        // Do the  search
-        dynamic_type->search_above_dst(&info, dynamic_ptr, dynamic_ptr, public_path, false);
+        // static_type is not a public base of dst_type, so there is no
+        //   public path from (dynamic_ptr, dynamic_type) to it.
+    }
+    else if (is_equal(dynamic_type, dst_type, false))
+    {
+#if LIBCXXABI_BASE_TABLE_SLOTS > 0
+        // Look (static_ptr, static_type) up in the bases of dynamic_type
+        if (const flat_base_table* table = get_base_table(dynamic_type))
+            info.path_dst_ptr_to_static_ptr =
+                find_flat_base(table, dynamic_ptr, static_type, static_ptr);
+#endif
+        if (info.path_dst_ptr_to_static_ptr == unknown)
+        {
+            // Using giant short cut.  Add that information to info.
+            info.number_of_dst_type = 1;
+            // Do the  search
+            dynamic_type->search_above_dst(&info, dynamic_ptr, dynamic_ptr, public_path, false);
+        }
 #if _LIBCXX_DYNAMIC_FALLBACK
         // The following if should always be false because we should definitely
         //   find (static_ptr, static_type), either on a public or private path
@@ -531,6 +1063,12 @@ __dynamic_cast(const void* static_ptr,
         if (info.path_dst_ptr_to_static_ptr == public_path)
             dst_ptr = dynamic_ptr;
     }
+    else if (src2dst_offset >= 0 &&
+             (dst_ptr = downcast_with_hint(static_ptr, src2dst_offset, dst_type,
+                                           dynamic_ptr, dynamic_type)) != 0)
+    {
+        // The hint found the dst_type that static_ptr is a base of
+    }
     else
     {
         // Not using giant short cut.  Do the search
@@ -571,6 +1109,11 @@ __dynamic_cast(const void* static_ptr,
             break;
         }
     }
+#if LIBCXXABI_DYNAMIC_CAST_CACHE_SIZE > 0
+    dynamic_cast_cache.insert(key, dst_ptr == 0 ? no_cached_offset :
+                                   static_cast<const char*>(dst_ptr) -
+                                   static_cast<const char*>(dynamic_ptr));
+#endif
     return const_cast<void*>(dst_ptr);
 }
 
@@ -945,7 +1488,9 @@ __si_class_type_info::search_below_dst(__dynamic_cast_info* info,
     else
     {
         // This is not a static_type and not a dst_type
-        __base_type->search_below_dst(info, current_ptr, path_below, use_strcmp);
+        skip_single_inheritance(__base_type, info->static_type,
+                                info->dst_type, use_strcmp)
+            ->search_below_dst(info, current_ptr, path_below, use_strcmp);
     }
 }
 
@@ -1100,7 +1645,9 @@ __si_class_type_info::search_above_dst(__dynamic_cast_info* info,
     if (is_equal(this, info->static_type, use_strcmp))
         process_static_type_above_dst(info, dst_ptr, current_ptr, path_below);
     else
-        __base_type->search_above_dst(info, dst_ptr, current_ptr, path_below, use_strcmp);
+        skip_single_inheritance(__base_type, info->static_type,
+                                info->static_type, use_strcmp)
+            ->search_above_dst(info, dst_ptr, current_ptr, path_below, use_strcmp);
 }
 
 // This is the same algorithm as __vmi_class_type_info::search_above_dst but
@@ -0,0 +1,168 @@
+//===------------------------ type_name_table.ipp -------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// is_same_type_name compares two type_info's by name, for when several
+// type_info's may exist for one type.  Included by private_typeinfo.cpp
+// with _LIBCXX_DYNAMIC_FALLBACK or on Windows, after config.h, <stdint.h>,
+// <string.h> and <typeinfo>.
+
+#if LIBCXXABI_TYPE_NAME_SLOTS > 0
+
+// When type_info's are compared by name, each one is mapped once to a
+//   canonical type_info, the first one seen with the same name, so that
+//   later comparisons are a lookup by address instead of a strcmp.  Both
+//   tables only ever gain entries, which are claimed with a compare and
+//   swap.  Once a type_info can't be added to them, every comparison is a
+//   plain strcmp, which is cheaper than failing to find it each time.
+
+static const size_t max_type_name_probes = 16;
+
+// Canonical type_info's, indexed by a hash of the name.
+static const std::type_info* canonical_types[LIBCXXABI_TYPE_NAME_SLOTS];
+
+// The canonical type_info of each type_info seen, indexed by its address.
+//   There may be several type_info's with the same name, so there are more
+//   of these.
+//   The name of the type is kept too, so that a different type_info at the
+//   address of one that was unloaded is not given its canonical type_info.
+struct type_name_link
+{
+    const std::type_info* type;
+    const char*           name;
+    const std::type_info* canonical;
+};
+
+static type_name_link type_name_links[2 * LIBCXXABI_TYPE_NAME_SLOTS];
+
+static bool type_name_tables_full = false;
+
+static
+size_t
+hash_type_name(const char* name)
+{
+    size_t hash = 2166136261U;
+    for (; *name; ++name)
+        hash = (hash ^ static_cast<unsigned char>(*name)) * 16777619U;
+    return hash;
+}
+
+// Returns the canonical type_info with the same name as type, making type
+//   the canonical one if there isn't one yet, or null if the table is full.
+static
+const std::type_info*
+intern_type_name(const std::type_info* type)
+{
+    const char* name = type->name();
+    size_t hash = hash_type_name(name);
+    for (size_t i = 0; i < max_type_name_probes; ++i)
+    {
+        const std::type_info** slot =
+            &canonical_types[(hash + i) % LIBCXXABI_TYPE_NAME_SLOTS];
+        const std::type_info* canonical = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (canonical == 0 &&
+            __atomic_compare_exchange_n(slot, &canonical, type, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return type;
+        if (canonical == type || strcmp(canonical->name(), name) == 0)
+            return canonical;
+    }
+    return 0;
+}
+
+// Returns the canonical type_info for type, or null if it can't be recorded
+//   or its link is for another type_info that was at the same address.
+static
+const std::type_info*
+link_canonical_type(const std::type_info* type, uintptr_t hash)
+{
+    for (size_t i = 0; i < max_type_name_probes; ++i)
+    {
+        type_name_link& link =
+            type_name_links[(hash + i) % (2 * LIBCXXABI_TYPE_NAME_SLOTS)];
+        const std::type_info* linked = __atomic_load_n(&link.type, __ATOMIC_ACQUIRE);
+        if (linked == 0)
+        {
+            const std::type_info* canonical = intern_type_name(type);
+            if (canonical == 0)
+                break;
+            if (__atomic_compare_exchange_n(&link.type, &linked, type, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                __atomic_store_n(&link.name, type->name(), __ATOMIC_RELAXED);
+                __atomic_store_n(&link.canonical, canonical, __ATOMIC_RELEASE);
+                return canonical;
+            }
+        }
+        if (linked == type)
+        {
+            // The canonical type_info may not have been stored yet
+            const std::type_info* canonical =
+                __atomic_load_n(&link.canonical, __ATOMIC_ACQUIRE);
+            if (canonical == 0)
+            {
+                canonical = intern_type_name(type);
+                if (canonical == 0)
+                    break;
+                return canonical;
+            }
+            if (__atomic_load_n(&link.name, __ATOMIC_RELAXED) != type->name())
+                return 0;
+            return canonical;
+        }
+    }
+    __atomic_store_n(&type_name_tables_full, true, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Checks the first slot for type inline, which is where it usually is.
+inline
+const std::type_info*
+canonical_type(const std::type_info* type)
+{
+    uintptr_t hash = reinterpret_cast<uintptr_t>(type) * 2654435761U;
+    hash ^= hash >> 15;
+    type_name_link& link = type_name_links[hash % (2 * LIBCXXABI_TYPE_NAME_SLOTS)];
+    if (__atomic_load_n(&link.type, __ATOMIC_ACQUIRE) == type)
+    {
+        const std::type_info* canonical =
+            __atomic_load_n(&link.canonical, __ATOMIC_ACQUIRE);
+        if (canonical != 0 &&
+            __atomic_load_n(&link.name, __ATOMIC_RELAXED) == type->name())
+            return canonical;
+    }
+    return link_canonical_type(type, hash);
+}
+
+inline
+bool
+is_same_type_name(const std::type_info* x, const std::type_info* y)
+{
+    if (!__atomic_load_n(&type_name_tables_full, __ATOMIC_RELAXED))
+    {
+        const std::type_info* canonical_x = canonical_type(x);
+        if (canonical_x != 0)
+        {
+            const std::type_info* canonical_y = canonical_type(y);
+            if (canonical_y != 0)
+                return canonical_x == canonical_y;
+        }
+    }
+    return strcmp(x->name(), y->name()) == 0;
+}
+
+#else  // LIBCXXABI_TYPE_NAME_SLOTS == 0
+
+inline
+bool
+is_same_type_name(const std::type_info* x, const std::type_info* y)
+{
+    return strcmp(x->name(), y->name()) == 0;
+}
+
+#endif  // LIBCXXABI_TYPE_NAME_SLOTS
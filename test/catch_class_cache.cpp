@@ -0,0 +1,132 @@
+//===----------------------- catch_class_cache.cpp ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+/*
+    Throws the same types through the same handlers repeatedly, so that later
+    matches come from the cache of earlier ones, and checks that adjustedPtr
+    is still right each time.  In particular a thrown pointer to a class with
+    a virtual base may point into objects of different dynamic types, whose
+    virtual base is at different offsets.
+*/
+
+#include <assert.h>
+#include <thread>
+#include <vector>
+
+struct A {int a; A() : a(1) {}};
+struct B {int b; B() : b(2) {}};
+struct C : A, B {int c; C() : c(3) {}};
+struct D : C {};
+
+struct V {int v; V() : v(4) {}};
+struct E : virtual V {int e; E() : e(5) {}};
+struct F : B, E {int f; F() : f(6) {}};
+struct G : A, F {int g; G() : g(7) {}};
+
+// Ambiguous: two A bases, one through I and one through C.
+struct I : A {};
+struct H : I, C {};
+
+void test_class()
+{
+    for (int i = 0; i < 10; ++i)
+    {
+        try
+        {
+            throw D();
+        }
+        catch (B& b)
+        {
+            assert(b.b == 2);
+        }
+        try
+        {
+            throw G();
+        }
+        catch (V& v)
+        {
+            assert(v.v == 4);
+        }
+        try
+        {
+            try
+            {
+                throw H();
+            }
+            catch (A&)
+            {
+                assert(false);
+            }
+        }
+        catch (H&)
+        {
+        }
+    }
+}
+
+void test_pointer()
+{
+    E e;
+    F f;
+    G g;
+    E* objects[] = {&e, &f, &g};
+    for (int i = 0; i < 30; ++i)
+    {
+        E* p = objects[i % 3];
+        try
+        {
+            throw p;
+        }
+        catch (V* v)
+        {
+            assert(v == static_cast<V*>(p));
+            assert(v->v == 4);
+        }
+        try
+        {
+            throw static_cast<C*>(0);
+        }
+        catch (B* b)
+        {
+            assert(b == 0);
+        }
+        D d;
+        try
+        {
+            throw static_cast<C*>(&d);
+        }
+        catch (B* b)
+        {
+            assert(b == static_cast<B*>(&d));
+            assert(b->b == 2);
+        }
+    }
+}
+
+void test_threads()
+{
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.push_back(std::thread([] {
+            for (int i = 0; i < 100; ++i)
+            {
+                test_class();
+                test_pointer();
+            }
+        }));
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+int main()
+{
+    test_class();
+    test_pointer();
+    test_threads();
+}
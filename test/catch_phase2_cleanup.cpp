@@ -0,0 +1,207 @@
+//===---------------------- catch_phase2_cleanup.cpp ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Throws through frames whose catch clauses and exception specs do not catch
+// the exception but which have cleanups to run.  Phase 2 runs those cleanups
+// without matching the exception against the clauses again, so check that it
+// still lands in the handler phase 1 chose, and that it does so for a second
+// exception thrown while the first is being handled and for a rethrow.
+
+#include <assert.h>
+
+struct A {int a; A() : a(1) {}};
+struct B {int b; B() : b(2) {}};
+struct C : A, B {int c; C() : c(3) {}};
+struct I : A {};
+struct H : I, C {};  // two A bases
+
+int constructed = 0;
+int destroyed = 0;
+
+struct cleanup
+{
+    cleanup() {++constructed;}
+    ~cleanup() {++destroyed;}
+};
+
+void throw_c()
+{
+    cleanup c;
+    throw C();
+}
+
+// Does not catch a C.
+void no_match(void (*f)())
+{
+    cleanup c;
+    try
+    {
+        f();
+    }
+    catch (int)
+    {
+        assert(false);
+    }
+    catch (H&)
+    {
+        assert(false);
+    }
+}
+
+// The exception spec allows C, so this frame only has a cleanup to run.
+void allowed_by_spec(void (*f)()) throw (int, C)
+{
+    cleanup c;
+    no_match(f);
+}
+
+void throw_c_through_frames()
+{
+    cleanup c;
+    allowed_by_spec(throw_c);
+}
+
+void test_handler_above_frames()
+{
+    constructed = destroyed = 0;
+    try
+    {
+        throw_c_through_frames();
+        assert(false);
+    }
+    catch (long)
+    {
+        assert(false);
+    }
+    catch (B& b)
+    {
+        assert(b.b == 2);
+        assert(static_cast<C&>(b).c == 3);
+        assert(destroyed == constructed);
+    }
+    assert(constructed == 4);
+}
+
+// An A& clause does not catch an H, since H has two A bases.
+void throw_h()
+{
+    cleanup c;
+    try
+    {
+        throw H();
+    }
+    catch (A&)
+    {
+        assert(false);
+    }
+}
+
+void test_ambiguous_clause_in_frame()
+{
+    constructed = destroyed = 0;
+    try
+    {
+        throw_h();
+        assert(false);
+    }
+    catch (I& i)
+    {
+        assert(i.a == 1);
+        assert(destroyed == constructed);
+    }
+    assert(constructed == 1);
+}
+
+// While a C is being handled, throw an int through frames whose clauses
+// would have caught the C but not the int.
+void throw_int_while_handling()
+{
+    try
+    {
+        throw C();
+    }
+    catch (C&)
+    {
+        cleanup c;
+        try
+        {
+            cleanup d;
+            throw 5;
+        }
+        catch (C&)
+        {
+            assert(false);
+        }
+        catch (B&)
+        {
+            assert(false);
+        }
+    }
+}
+
+void test_nested_exception()
+{
+    constructed = destroyed = 0;
+    try
+    {
+        throw_int_while_handling();
+        assert(false);
+    }
+    catch (C&)
+    {
+        assert(false);
+    }
+    catch (int i)
+    {
+        assert(i == 5);
+        assert(destroyed == constructed);
+    }
+    assert(constructed == 2);
+}
+
+void rethrow()
+{
+    try
+    {
+        throw_c();
+    }
+    catch (C&)
+    {
+        cleanup c;
+        throw;
+    }
+}
+
+void test_rethrow()
+{
+    constructed = destroyed = 0;
+    try
+    {
+        no_match(rethrow);
+        assert(false);
+    }
+    catch (A& a)
+    {
+        assert(a.a == 1);
+        assert(static_cast<C&>(a).c == 3);
+        assert(destroyed == constructed);
+    }
+    assert(constructed == 3);
+}
+
+int main()
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        test_handler_above_frames();
+        test_ambiguous_clause_in_frame();
+        test_nested_exception();
+        test_rethrow();
+    }
+}
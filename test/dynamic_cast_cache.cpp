@@ -0,0 +1,147 @@
+//===----------------------- dynamic_cast_cache.cpp -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Repeats the same dynamic_casts, so that all but the first come from the
+// cache, on objects where the same static type appears at several offsets
+// or the answer changes while the object is being constructed.  The first
+// time each is done also exercises the flattened base tables.
+
+#include <cassert>
+#include <thread>
+#include <vector>
+
+/*
+
+  A   A
+  |   |
+  B1  B2     V
+   \ /      / \
+    C      W1  W2
+            \ /
+             X
+
+*/
+
+struct A {virtual ~A() {} int a;};
+struct B1 : A {int b1;};
+struct B2 : A {int b2;};
+struct C : B1, B2 {int c;};
+
+struct V {virtual ~V() {} int v;};
+struct W1 : virtual V {int w1;};
+struct W2 : virtual V {int w2;};
+struct X : W1, W2 {int x;};
+
+// Casts this to the most derived type while it is still being constructed.
+struct Y;
+int constructed_as_y = 0;
+struct Z
+{
+    Z();
+    virtual ~Z() {}
+};
+struct Y : Z {};
+Z::Z() {if (dynamic_cast<Y*>(this)) ++constructed_as_y;}
+
+// While P is constructed as part of R, its virtual base is where R puts it,
+// not where a complete P would have it.
+struct P : virtual V
+{
+    P()
+    {
+        V* v = this;
+        assert(dynamic_cast<P*>(v) == this);
+        assert(dynamic_cast<W1*>(v) == 0);
+    }
+};
+struct R : W1, P {int r;};
+
+void test_repeated_base()
+{
+    C c;
+    A* a1 = static_cast<B1*>(&c);
+    A* a2 = static_cast<B2*>(&c);
+    for (int i = 0; i < 10; ++i)
+    {
+        assert(dynamic_cast<C*>(a1) == &c);
+        assert(dynamic_cast<C*>(a2) == &c);
+        assert(dynamic_cast<B1*>(a1) == static_cast<B1*>(&c));
+        assert(dynamic_cast<B2*>(a2) == static_cast<B2*>(&c));
+        assert(dynamic_cast<B2*>(a1) == static_cast<B2*>(&c));
+        assert(dynamic_cast<B1*>(a2) == static_cast<B1*>(&c));
+        assert(dynamic_cast<void*>(a2) == &c);
+    }
+    B1 b1;
+    A* a = &b1;
+    for (int i = 0; i < 10; ++i)
+    {
+        assert(dynamic_cast<C*>(a) == 0);
+        assert(dynamic_cast<B2*>(a) == 0);
+        assert(dynamic_cast<B1*>(a) == &b1);
+    }
+}
+
+void test_virtual_base()
+{
+    X x;
+    W1 w1;
+    V* vx = &x;
+    V* vw = &w1;
+    for (int i = 0; i < 10; ++i)
+    {
+        assert(dynamic_cast<X*>(vx) == &x);
+        assert(dynamic_cast<W1*>(vx) == static_cast<W1*>(&x));
+        assert(dynamic_cast<W2*>(vx) == static_cast<W2*>(&x));
+        assert(dynamic_cast<X*>(vw) == 0);
+        assert(dynamic_cast<W1*>(vw) == &w1);
+        assert(dynamic_cast<W2*>(vw) == 0);
+    }
+}
+
+void test_construction()
+{
+    for (int i = 0; i < 10; ++i)
+    {
+        Y y;
+        Z* z = &y;
+        assert(dynamic_cast<Y*>(z) == &y);
+    }
+    assert(constructed_as_y == 0);
+    for (int i = 0; i < 10; ++i)
+    {
+        P p;
+        R r;
+        V* v = &r;
+        assert(dynamic_cast<P*>(v) == static_cast<P*>(&r));
+        assert(dynamic_cast<W1*>(v) == static_cast<W1*>(&r));
+    }
+}
+
+void test_threads()
+{
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.push_back(std::thread([] {
+            for (int i = 0; i < 1000; ++i)
+            {
+                test_repeated_base();
+                test_virtual_base();
+            }
+        }));
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+int main()
+{
+    test_repeated_base();
+    test_virtual_base();
+    test_construction();
+    test_threads();
+}
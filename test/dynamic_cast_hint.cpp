@@ -0,0 +1,120 @@
+//===------------------------- dynamic_cast_hint.cpp ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Calls __dynamic_cast with each kind of src2dst_offset hint the compiler
+// passes, on objects where the hint decides the cast and on objects where
+// the cast has to fall back to the full search.  Every cast is done twice
+// so that the second one can come from the cache.
+
+#include <cassert>
+#include <cstddef>
+#include <typeinfo>
+
+extern "C" void* __dynamic_cast(const void* static_ptr,
+                                const std::type_info* static_type,
+                                const std::type_info* dst_type,
+                                std::ptrdiff_t src2dst_offset);
+
+struct B1 {virtual ~B1() {} int b1;};
+struct B2 {virtual ~B2() {} int b2;};
+struct D : B1, B2 {int d;};
+struct F : B2 {int f;};
+struct E : F, D {int e;};  // a second B2 that is not part of a D
+
+struct P : private B1 {B1* base() {return this;} int p;};
+
+struct T {virtual ~T() {} int t;};
+struct M : B1, T {int m;};
+
+template <class Dst, class Static>
+void* cast(Static* p, std::ptrdiff_t hint)
+{
+    void* first = __dynamic_cast(p, &typeid(Static), &typeid(Dst), hint);
+    void* second = __dynamic_cast(p, &typeid(Static), &typeid(Dst), hint);
+    assert(first == second);
+    return first;
+}
+
+template <class Base, class Derived>
+std::ptrdiff_t offset_of_base(Derived* d)
+{
+    return reinterpret_cast<char*>(static_cast<Base*>(d)) -
+           reinterpret_cast<char*>(d);
+}
+
+// src2dst_offset >= 0: static_type is a unique public nonvirtual base of
+// dst_type at that offset.
+void test_offset_hint()
+{
+    D d;
+    std::ptrdiff_t hint = offset_of_base<B2>(&d);
+    assert(hint > 0);
+    // The dynamic type is dst_type, and the hint points at it.
+    assert(cast<D>(static_cast<B2*>(&d), hint) == &d);
+
+    // The dynamic type is derived from dst_type, and the hint points at the
+    // dst_type that static_ptr is part of.
+    E e;
+    D* ed = &e;
+    assert(cast<D>(static_cast<B2*>(ed), hint) == ed);
+
+    // static_ptr is the B2 of E that is not in a D.  The hint points
+    // outside the object, but the cast still succeeds as a cross cast.
+    B2* eb2 = static_cast<F*>(&e);
+    assert(reinterpret_cast<char*>(eb2) - hint < reinterpret_cast<char*>(&e));
+    assert(cast<D>(eb2, hint) == ed);
+
+    // The hint for B1 is 0, which points at the D for either object.
+    assert(offset_of_base<B1>(&d) == 0);
+    assert(cast<D>(static_cast<B1*>(&d), 0) == &d);
+    assert(cast<D>(static_cast<B1*>(ed), 0) == ed);
+
+    // A B2 that is not part of any D.
+    B2 b2;
+    assert(cast<D>(&b2, hint) == 0);
+}
+
+// src2dst_offset == -2: static_type is not a public base of dst_type.
+void test_not_public_base_hint()
+{
+    // The dynamic type is dst_type, so there is nothing else to find.
+    P p;
+    assert(cast<P>(p.base(), -2) == 0);
+
+    // B1 is not a base of T at all, but an M is both, so the cast succeeds
+    // as a cross cast.
+    M m;
+    assert(cast<T>(static_cast<B1*>(&m), -2) == static_cast<T*>(&m));
+
+    // Neither works for a B1 that is not part of an M.
+    D d;
+    assert(cast<T>(static_cast<B1*>(&d), -2) == 0);
+}
+
+// src2dst_offset == -1: no hint.  The same casts must give the same answers.
+void test_no_hint()
+{
+    D d;
+    E e;
+    D* ed = &e;
+    P p;
+    M m;
+    assert(cast<D>(static_cast<B2*>(&d), -1) == &d);
+    assert(cast<D>(static_cast<B2*>(ed), -1) == ed);
+    assert(cast<D>(static_cast<B2*>(static_cast<F*>(&e)), -1) == ed);
+    assert(cast<P>(p.base(), -1) == 0);
+    assert(cast<T>(static_cast<B1*>(&m), -1) == static_cast<T*>(&m));
+}
+
+int main()
+{
+    test_offset_hint();
+    test_not_public_base_hint();
+    test_no_hint();
+}
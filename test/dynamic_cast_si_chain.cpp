@@ -0,0 +1,125 @@
+//===---------------------- dynamic_cast_si_chain.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// dynamic_casts and catches through long chains of single inheritance, with
+// and without multiple inheritance at either end or in the middle of them.
+
+#include <cassert>
+
+template <int N> struct S : S<N-1> {};
+template <> struct S<0> { virtual ~S() {} };
+
+/*
+
+  S<0>           S<0>
+   |              |
+  ...            ...
+   |              |
+  S<200>  Q      S<10>
+     \   /        |
+       M         S<20>   W
+       |           \    / \
+      ...           Amb    S<10>
+       |
+      U<100>
+
+*/
+
+struct Q { virtual ~Q() {} };
+struct M : S<200>, Q {};
+
+template <int N> struct U : U<N-1> {};
+template <> struct U<0> : M {};
+
+struct W : S<10> {};
+struct Amb : S<20>, W {};
+
+void test_chain()
+{
+    S<200> s;
+    S<0>* p0 = &s;
+    assert(dynamic_cast<S<200>*>(p0) == &s);
+    assert(dynamic_cast<S<100>*>(p0) == &s);
+    assert(dynamic_cast<M*>(p0) == 0);
+    assert(dynamic_cast<void*>(p0) == &s);
+    S<100>* p100 = &s;
+    assert(dynamic_cast<S<150>*>(p100) == &s);
+    assert(dynamic_cast<Q*>(p100) == 0);
+}
+
+void test_vmi_in_chain()
+{
+    U<100> u;
+    Q* q = &u;
+    S<0>* p0 = &u;
+    assert(dynamic_cast<S<0>*>(q) == p0);
+    assert(dynamic_cast<S<123>*>(q) == static_cast<S<123>*>(&u));
+    assert(dynamic_cast<U<50>*>(q) == &u);
+    assert(dynamic_cast<U<100>*>(p0) == &u);
+    assert(dynamic_cast<Q*>(p0) == q);
+    assert(dynamic_cast<W*>(p0) == 0);
+    assert(dynamic_cast<U<100>*>(static_cast<M*>(&u)) == &u);
+}
+
+void test_ambiguous()
+{
+    Amb a;
+    W* w = &a;
+    assert(dynamic_cast<S<20>*>(w) == static_cast<S<20>*>(&a));
+    assert(dynamic_cast<S<5>*>(w) == static_cast<S<5>*>(w));
+    assert(dynamic_cast<Amb*>(static_cast<S<15>*>(&a)) == &a);
+    assert(dynamic_cast<Amb*>(static_cast<S<10>*>(w)) == &a);
+}
+
+void test_catch()
+{
+    try
+    {
+        throw S<200>();
+    }
+    catch (S<0>&)
+    {
+    }
+    try
+    {
+        throw U<100>();
+    }
+    catch (S<1>& s)
+    {
+        assert(dynamic_cast<U<100>*>(&s) != 0);
+    }
+    try
+    {
+        throw Amb();
+    }
+    catch (S<5>&)
+    {
+        assert(false);
+    }
+    catch (S<15>&)
+    {
+    }
+    try
+    {
+        throw new U<100>;
+    }
+    catch (S<2>* s)
+    {
+        assert(dynamic_cast<U<100>*>(s) != 0);
+        delete s;
+    }
+}
+
+int main()
+{
+    test_chain();
+    test_vmi_in_chain();
+    test_ambiguous();
+    test_catch();
+}
@@ -0,0 +1,138 @@
+//===--------------------- test_call_site_table.cpp -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Builds call-site tables in the uleb128 and udata4 encodings and checks
+// that skip_call_sites finds the right entry for every offset, including
+// offsets in the gaps between call sites and past the last one.  Tables in
+// other encodings must be left alone.
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+// The personality routine is already in the library; only its call-site
+// walk is tested here.
+#define __gxx_personality_v0 test_gxx_personality_v0
+#define __cxa_call_unexpected test_cxa_call_unexpected
+#include "../src/cxa_personality.cpp"
+
+#if !__USING_SJLJ_EXCEPTIONS__
+
+using namespace __cxxabiv1;
+
+struct call_site
+{
+    uintptr_t start;
+    uintptr_t length;
+    size_t offset;  // of the entry in the table
+};
+
+static void put_uleb128(std::vector<uint8_t>& table, uintptr_t value)
+{
+    do
+    {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        table.push_back(byte);
+    } while (value != 0);
+}
+
+static void put_field(std::vector<uint8_t>& table, uint8_t encoding,
+                      uintptr_t value)
+{
+    if (encoding == DW_EH_PE_uleb128)
+        put_uleb128(table, value);
+    else
+    {
+        uint32_t v = static_cast<uint32_t>(value);
+        uint8_t bytes[sizeof(v)];
+        std::memcpy(bytes, &v, sizeof(v));
+        table.insert(table.end(), bytes, bytes + sizeof(v));
+    }
+}
+
+// Call sites of varying lengths with gaps of varying sizes between them, so
+// that the uleb128 fields take one, two and three bytes.
+static std::vector<uint8_t> build_table(uint8_t encoding,
+                                        std::vector<call_site>& sites)
+{
+    std::vector<uint8_t> table;
+    uintptr_t start = 3;
+    for (uintptr_t i = 0; i < 40; ++i)
+    {
+        call_site site = {start, 1 + (i * 37) % 300, table.size()};
+        sites.push_back(site);
+        put_field(table, encoding, site.start);
+        put_field(table, encoding, site.length);
+        put_field(table, encoding, i % 5 == 0 ? 0 : 0x10 * i);  // landing pad
+        put_uleb128(table, i % 3 == 0 ? 0 : i * 50);             // action
+        start += site.length + (i % 4 == 0 ? 0 : i * i * 11);
+    }
+    return table;
+}
+
+static int test_encoding(uint8_t encoding)
+{
+    std::vector<call_site> sites;
+    std::vector<uint8_t> table = build_table(encoding, sites);
+    const uint8_t* begin = &table[0];
+    const uint8_t* end = begin + table.size();
+    const call_site& last = sites.back();
+    int failures = 0;
+    for (uintptr_t ip = 0; ip < last.start + last.length + 100; ++ip)
+    {
+        const uint8_t* expected = end;
+        for (size_t i = 0; i < sites.size(); ++i)
+            if (ip < sites[i].start + sites[i].length)
+            {
+                expected = begin + sites[i].offset;
+                break;
+            }
+        if (skip_call_sites(encoding, begin, end, ip) != expected)
+            ++failures;
+    }
+    // The entry found must decode to the call site it claims to be.
+    const uint8_t* p = skip_call_sites(encoding, begin, end, sites[7].start);
+    assert(readEncodedPointer(&p, encoding) == sites[7].start);
+    assert(readEncodedPointer(&p, encoding) == sites[7].length);
+    return failures;
+}
+
+// Other encodings are walked by scan_eh_tab itself.
+static int test_other_encoding()
+{
+    std::vector<uint8_t> table(64, 0xFF);
+    const uint8_t* begin = &table[0];
+    const uint8_t* end = begin + table.size();
+    int failures = 0;
+    if (skip_call_sites(DW_EH_PE_udata8, begin, end, 1000) != begin)
+        ++failures;
+    if (skip_call_sites(DW_EH_PE_sdata4, begin, end, 1000) != begin)
+        ++failures;
+    return failures;
+}
+
+int main()
+{
+    int failures = 0;
+    failures += test_encoding(DW_EH_PE_uleb128);
+    failures += test_encoding(DW_EH_PE_udata4);
+    failures += test_other_encoding();
+    return failures != 0;
+}
+
+#else  // __USING_SJLJ_EXCEPTIONS__
+
+int main()
+{
+}
+
+#endif  // __USING_SJLJ_EXCEPTIONS__
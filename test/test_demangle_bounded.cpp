@@ -0,0 +1,173 @@
+//===---------------------- test_demangle_bounded.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Demangles names that fit their budget, names whose output is too long, and
+// names that blow up exponentially or nest deeply, with
+// __cxa_demangle_bounded, and checks that it stops where it should.
+
+#include <cxxabi.h>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+const int budget_exceeded = -5;
+
+const char* cases[] =
+{
+    "_Z1A",
+    "_Z4testI1A1BE1Cv",
+    "_ZN13dyldbootstrap5startEPK12macho_headeriPPKcl",
+    "_ZNKSt3__16vectorIiNS_9allocatorIiEEE4sizeEv",
+    "_ZN1AcvT_IiEEv",
+    "_ZTVN10__cxxabiv117__class_type_infoE",
+    "PFvRKiE",
+};
+
+const unsigned N = sizeof(cases) / sizeof(cases[0]);
+
+// A function whose parameters each take the previous two as parameters, so
+// that every parameter is twice as long as the one before it
+std::string exponential(int levels)
+{
+    const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    std::string name("_Z1fPFviE");
+    for (int i = 0, sub = 0; i < levels; ++i, sub += 2)
+    {
+        std::string s("S");
+        s += digits[sub];
+        s += '_';
+        name += "PFv" + s + s + "E";
+    }
+    return name;
+}
+
+bool ends_with_dots(const char* s)
+{
+    std::size_t n = std::strlen(s);
+    return n >= 3 && std::strcmp(s + n - 3, "...") == 0;
+}
+
+void test_within_budget(abi::__cxa_demangle_context* context)
+{
+    for (unsigned i = 0; i < N; ++i)
+    {
+        int status;
+        char* plain = abi::__cxa_demangle(cases[i], 0, 0, &status);
+        assert(status == 0);
+        char* bounded = abi::__cxa_demangle_bounded(context, cases[i], 0, 0,
+                                                    &status, 1000, 1000);
+        assert(status == 0);
+        assert(std::strcmp(bounded, plain) == 0);
+        std::free(bounded);
+        // No limits at all
+        bounded = abi::__cxa_demangle_bounded(context, cases[i], 0, 0,
+                                              &status, 0, 0);
+        assert(status == 0);
+        assert(std::strcmp(bounded, plain) == 0);
+        std::free(bounded);
+        // Exactly long enough
+        bounded = abi::__cxa_demangle_bounded(context, cases[i], 0, 0, &status,
+                                              std::strlen(plain), 0);
+        assert(status == 0);
+        assert(std::strcmp(bounded, plain) == 0);
+        std::free(bounded);
+        std::free(plain);
+    }
+}
+
+void test_too_long(abi::__cxa_demangle_context* context)
+{
+    int status;
+    const char* mangled = "_ZN13dyldbootstrap5startEPK12macho_headeriPPKcl";
+    char* r = abi::__cxa_demangle_bounded(context, mangled, 0, 0, &status,
+                                          20, 0);
+    assert(status == budget_exceeded);
+    assert(std::strcmp(r, "dyldbootstrap::st...") == 0);
+    std::free(r);
+    r = abi::__cxa_demangle_bounded(context, mangled, 0, 0, &status, 2, 0);
+    assert(status == budget_exceeded);
+    assert(std::strcmp(r, "..") == 0);
+    std::free(r);
+    // A name that would be several megabytes long is cut short long before
+    // that, and what is there is the start of the name
+    std::string big = exponential(16);
+    r = abi::__cxa_demangle_bounded(context, big.c_str(), 0, 0, &status,
+                                    200, 0);
+    assert(status == budget_exceeded);
+    assert(std::strlen(r) <= 200);
+    assert(ends_with_dots(r));
+    std::string small = exponential(6);
+    char* whole = abi::__cxa_demangle(small.c_str(), 0, 0, &status);
+    assert(status == 0);
+    assert(std::strncmp(r, whole, 100) == 0);
+    std::free(whole);
+    std::free(r);
+}
+
+void test_too_many_steps(abi::__cxa_demangle_context* context)
+{
+    int status;
+    std::string big = exponential(16);
+    char* r = abi::__cxa_demangle_bounded(context, big.c_str(), 0, 0, &status,
+                                          0, 20);
+    assert(status == budget_exceeded);
+    assert(std::strncmp(r, "f(void (*)(int)", 15) == 0);
+    assert(ends_with_dots(r));
+    std::free(r);
+    // Too deep to demangle without running out of stack
+    std::string deep("_Z1f");
+    deep.append(100000, 'P');
+    deep += 'i';
+    r = abi::__cxa_demangle_bounded(context, deep.c_str(), 0, 0, &status,
+                                    0, 200);
+    assert(status == budget_exceeded);
+    assert(std::strcmp(r, "f(...") == 0);
+    std::free(r);
+    // A forward reference cut off before it is filled in is left as written
+    r = abi::__cxa_demangle_bounded(context, "_ZN1AcvT_I1BIiEEEv", 0, 0,
+                                    &status, 0, 2);
+    assert(status == budget_exceeded);
+    assert(std::strcmp(r, "A::operator T_...") == 0);
+    std::free(r);
+}
+
+void test_errors(abi::__cxa_demangle_context* context)
+{
+    int status;
+    assert(abi::__cxa_demangle_bounded(context, "_ZIPPreEncode", 0, 0, &status,
+                                       100, 100) == 0);
+    assert(status == -2);
+    assert(abi::__cxa_demangle_bounded(context, 0, 0, 0, &status,
+                                       100, 100) == 0);
+    assert(status == -3);
+    // A buffer that is too small grows, even when the name is cut short
+    std::size_t len = 4;
+    char* buf = static_cast<char*>(std::malloc(len));
+    buf = abi::__cxa_demangle_bounded(context, "_Z4testI1A1BE1Cv", buf, &len,
+                                      &status, 10, 0);
+    assert(status == budget_exceeded);
+    assert(std::strcmp(buf, "C test<...") == 0);
+    assert(len >= 11);
+    std::free(buf);
+}
+
+int main()
+{
+    abi::__cxa_demangle_context* context = abi::__cxa_demangle_context_create();
+    for (int round = 0; round < 2; ++round)
+    {
+        abi::__cxa_demangle_context* c = round == 0 ? 0 : context;
+        test_within_budget(c);
+        test_too_long(c);
+        test_too_many_steps(c);
+        test_errors(c);
+    }
+    abi::__cxa_demangle_context_destroy(context);
+}
@@ -0,0 +1,127 @@
+//===---------------------- test_demangle_context.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Demangles the same names, several times over, with __cxa_demangle, with a
+// reused demangler context, and in batches, and checks that all three agree.
+
+#include <cxxabi.h>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+const char* cases[][2] =
+{
+    {"_Z1A", "A"},
+    {"_Z4testI1A1BE1Cv", "C test<A, B>()"},
+    {"_ZN13dyldbootstrap5startEPK12macho_headeriPPKcl", "dyldbootstrap::start(macho_header const*, int, char const**, long)"},
+    {"_ZN4dyld24registerUndefinedHandlerEPFvPKcE", "dyld::registerUndefinedHandler(void (*)(char const*))"},
+    {"_ZNSt3__112basic_stringIcNS_11char_traitsIcEENS_9allocatorIcEEE6appendEPKcm", "std::__1::basic_string<char, std::__1::char_traits<char>, std::__1::allocator<char> >::append(char const*, unsigned long)"},
+    {"_ZNKSt3__16vectorIiNS_9allocatorIiEEE4sizeEv", "std::__1::vector<int, std::__1::allocator<int> >::size() const"},
+    {"_ZN1AcvT_IiEEv", "A::operator int<int>()"},
+    {"_ZN6test205test1IiEEvDTcl1fIEcvT__EEE", "void test20::test1<int>(decltype(f<>((int)())))"},
+    {"_ZZN1A1fEvE1x", "A::f()::x"},
+    {"_ZTVN10__cxxabiv117__class_type_infoE", "vtable for __cxxabiv1::__class_type_info"},
+    {"i", "int"},
+    {"PFvRKiE", "void (*)(int const&)"},
+};
+
+const unsigned N = sizeof(cases) / sizeof(cases[0]);
+
+const char* invalid_cases[] =
+{
+    "_ZIPPreEncode",
+    "Agentt",
+    "_Z",
+};
+
+const unsigned NI = sizeof(invalid_cases) / sizeof(invalid_cases[0]);
+
+void test_context()
+{
+    abi::__cxa_demangle_context* context = abi::__cxa_demangle_context_create();
+    assert(context != 0);
+    char* buf = 0;
+    std::size_t len = 0;
+    for (int round = 0; round < 3; ++round)
+    {
+        for (unsigned i = 0; i < N; ++i)
+        {
+            int status;
+            buf = abi::__cxa_demangle_with_context(context, cases[i][0], buf,
+                                                   &len, &status);
+            assert(status == 0);
+            assert(buf != 0);
+            assert(std::strcmp(buf, cases[i][1]) == 0);
+            char* plain = abi::__cxa_demangle(cases[i][0], 0, 0, &status);
+            assert(status == 0);
+            assert(std::strcmp(buf, plain) == 0);
+            std::free(plain);
+        }
+        for (unsigned i = 0; i < NI; ++i)
+        {
+            int status;
+            char* demangled = abi::__cxa_demangle_with_context(
+                context, invalid_cases[i], buf, &len, &status);
+            assert(status == -2);
+            assert(demangled == 0);
+        }
+    }
+    std::free(buf);
+    int status;
+    assert(abi::__cxa_demangle_with_context(0, "_Z1A", 0, 0, &status) == 0);
+    assert(status == -3);
+    abi::__cxa_demangle_context_destroy(context);
+}
+
+void test_batch()
+{
+    abi::__cxa_demangle_context* context = abi::__cxa_demangle_context_create();
+    assert(context != 0);
+    const unsigned count = N + NI;
+    const char* names[count];
+    for (unsigned i = 0; i < N; ++i)
+        names[i] = cases[i][0];
+    for (unsigned i = 0; i < NI; ++i)
+        names[N + i] = invalid_cases[i];
+    std::size_t offsets[count];
+    int statuses[count];
+    // Start with a buffer too small for anything so that it has to grow
+    std::size_t len = 1;
+    char* buf = static_cast<char*>(std::malloc(len));
+    for (int round = 0; round < 3; ++round)
+    {
+        buf = abi::__cxa_demangle_batch(context, names, count, buf, &len,
+                                        offsets, statuses);
+        assert(buf != 0);
+        for (unsigned i = 0; i < N; ++i)
+        {
+            assert(statuses[i] == 0);
+            assert(offsets[i] < len);
+            assert(std::strcmp(buf + offsets[i], cases[i][1]) == 0);
+        }
+        for (unsigned i = 0; i < NI; ++i)
+        {
+            assert(statuses[N + i] == -2);
+            assert(offsets[N + i] == static_cast<std::size_t>(-1));
+        }
+    }
+    std::free(buf);
+    // No names, and no buffer
+    len = 0;
+    assert(abi::__cxa_demangle_batch(context, 0, 0, 0, &len, 0, 0) == 0);
+    assert(len == 0);
+    abi::__cxa_demangle_context_destroy(context);
+}
+
+int main()
+{
+    test_context();
+    test_batch();
+}
@@ -0,0 +1,220 @@
+//===----------------------- test_demangle_tree.cpp -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Demangles names into trees, checks the pieces of each tree, and checks
+// that the string put together from it is the same as from __cxa_demangle,
+// for these names and for every name that test_demangle.cpp checks.
+
+#include <cxxabi.h>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "demangle_cases.h"
+
+using namespace abi;
+
+struct tree_case
+{
+    const char* mangled;
+    int kind;
+    const char* return_type;
+    const char* scope;
+    const char* base_name;
+    const char* template_args;  // separated by '|'
+    const char* parameters;     // separated by '|'
+    const char* qualifiers;
+};
+
+const tree_case tree_cases[] =
+{
+    {"_Z1A", __cxa_demangle_node_name, 0, 0, "A", 0, 0, 0},
+    {"_ZN1A1xE", __cxa_demangle_node_name, 0, "A", "x", 0, 0, 0},
+    {"_Z1fv", __cxa_demangle_node_function, 0, 0, "f", 0, "", 0},
+    {"_Z4testI1A1BE1Cv", __cxa_demangle_node_function, "C", 0, "test", "A|B", "", 0},
+    {"_ZN13dyldbootstrap5startEPK12macho_headeriPPKcl",
+        __cxa_demangle_node_function, 0, "dyldbootstrap", "start", 0,
+        "macho_header const*|int|char const**|long", 0},
+    {"_ZNKSt3__16vectorIiNS_9allocatorIiEEE4sizeEv",
+        __cxa_demangle_node_function, 0,
+        "std::__1::vector<int, std::__1::allocator<int> >", "size", 0, "",
+        "const"},
+    {"_ZNSt3__112basic_stringIcNS_11char_traitsIcEENS_9allocatorIcEEE6appendEPKcm",
+        __cxa_demangle_node_function, 0,
+        "std::__1::basic_string<char, std::__1::char_traits<char>, std::__1::allocator<char> >",
+        "append", 0, "char const*|unsigned long", 0},
+    {"_ZNSsC1ERKSs", __cxa_demangle_node_function, 0,
+        "std::basic_string<char, std::char_traits<char>, std::allocator<char> >",
+        "basic_string", 0, "std::string const&", 0},
+    {"_ZNKR1A1fEv", __cxa_demangle_node_function, 0, "A", "f", 0, "", "const &"},
+    {"_ZN1AcvT_IiEEv", __cxa_demangle_node_function, 0, "A", "operator int",
+        "int", "", 0},
+    {"_Z1fIPFviEEPS0_v", __cxa_demangle_node_function, "void (*)(int)", 0,
+        "f", "void (*)(int)", "", 0},
+    {"_ZSt4swapIiEvRT_S1_", __cxa_demangle_node_function, "void", "std",
+        "swap", "int", "int&|int&", 0},
+    {"_ZZN1A1fEvE1x", __cxa_demangle_node_name, 0, "A::f()", "x", 0, 0, 0},
+    {"_ZZ1fvEN1B1gEv", __cxa_demangle_node_function, 0, "f()::B", "g", 0, "", 0},
+    {"_ZN6test205test1IiEEvDTcl1fIEcvT__EEE", __cxa_demangle_node_function,
+        "void", "test20", "test1", "int", "decltype(f<>((int)()))", 0},
+    {"_Z1fv.cold", __cxa_demangle_node_function, 0, 0, "f", 0, "", 0},
+    {"___Z1fv_block_invoke", __cxa_demangle_node_function, 0, 0, "f", 0, "", 0},
+    {"_ZTVN10__cxxabiv117__class_type_infoE", __cxa_demangle_node_other, 0, 0, 0, 0, 0, 0},
+    {"PFvRKiE", __cxa_demangle_node_other, 0, 0, 0, 0, 0, 0},
+};
+
+const unsigned NT = sizeof(tree_cases) / sizeof(tree_cases[0]);
+
+const char* invalid_cases[] =
+{
+    "_ZIPPreEncode",
+    "Agentt",
+    "_Z",
+};
+
+const unsigned NI = sizeof(invalid_cases) / sizeof(invalid_cases[0]);
+
+// Checks that the children of node are the pieces of expected, in order
+void check_list(const __cxa_demangle_node* node, int kind, const char* expected)
+{
+    std::string rest(expected);
+    for (std::size_t i = 0; i < node->child_count; ++i)
+    {
+        assert(node->children[i].kind == kind);
+        std::size_t bar = rest.find('|');
+        assert(rest.substr(0, bar) == node->children[i].text);
+        rest = bar == std::string::npos ? "" : rest.substr(bar + 1);
+    }
+    assert(rest.empty());
+}
+
+void check_text(const __cxa_demangle_node* node, const char* expected)
+{
+    if (expected == 0)
+        assert(node == 0);
+    else
+    {
+        assert(node != 0);
+        assert(std::strcmp(node->text, expected) == 0);
+    }
+}
+
+void check(__cxa_demangle_context* context, const tree_case& c)
+{
+    int status;
+    __cxa_demangle_tree* tree = __cxa_demangle_tree_create(context, c.mangled,
+                                                           &status);
+    assert(status == 0);
+    assert(tree != 0);
+    const __cxa_demangle_node* root = __cxa_demangle_tree_root(tree);
+    assert(root->kind == c.kind);
+    const __cxa_demangle_node* name = root;
+    if (c.kind == __cxa_demangle_node_function)
+    {
+        assert(root->text == 0);
+        check_text(__cxa_demangle_node_child(root, __cxa_demangle_node_return_type),
+                   c.return_type);
+        check_text(__cxa_demangle_node_child(root, __cxa_demangle_node_qualifiers),
+                   c.qualifiers);
+        const __cxa_demangle_node* params =
+            __cxa_demangle_node_child(root, __cxa_demangle_node_parameters);
+        assert(params != 0);
+        check_list(params, __cxa_demangle_node_parameter, c.parameters);
+        name = __cxa_demangle_node_child(root, __cxa_demangle_node_name);
+        assert(name != 0);
+    }
+    if (c.kind != __cxa_demangle_node_other)
+    {
+        check_text(__cxa_demangle_node_child(name, __cxa_demangle_node_scope),
+                   c.scope);
+        check_text(__cxa_demangle_node_child(name, __cxa_demangle_node_base_name),
+                   c.base_name);
+        const __cxa_demangle_node* args =
+            __cxa_demangle_node_child(name, __cxa_demangle_node_template_args);
+        if (c.template_args == 0)
+            assert(args == 0);
+        else
+            check_list(args, __cxa_demangle_node_template_arg, c.template_args);
+    }
+    else
+        assert(root->child_count == 0);
+    char* plain = __cxa_demangle(c.mangled, 0, 0, &status);
+    assert(status == 0);
+    const char* s = __cxa_demangle_tree_string(tree);
+    assert(std::strcmp(s, plain) == 0);
+    // The string is only put together once
+    assert(__cxa_demangle_tree_string(tree) == s);
+    std::free(plain);
+    __cxa_demangle_tree_destroy(tree);
+}
+
+// A name comes back from its tree as it does from __cxa_demangle, and its
+// scope, base name and template arguments put back together make the name.
+void check_round_trip(__cxa_demangle_context* context, const char* mangled)
+{
+    int status;
+    char* plain = __cxa_demangle(mangled, 0, 0, &status);
+    int tree_status;
+    __cxa_demangle_tree* tree = __cxa_demangle_tree_create(context, mangled,
+                                                           &tree_status);
+    assert(tree_status == status);
+    assert((tree == 0) == (plain == 0));
+    if (tree == 0)
+        return;
+    assert(std::strcmp(__cxa_demangle_tree_string(tree), plain) == 0);
+    const __cxa_demangle_node* root = __cxa_demangle_tree_root(tree);
+    const __cxa_demangle_node* name = root;
+    if (root->kind == __cxa_demangle_node_function)
+        name = __cxa_demangle_node_child(root, __cxa_demangle_node_name);
+    if (name->kind == __cxa_demangle_node_name)
+    {
+        const __cxa_demangle_node* scope =
+            __cxa_demangle_node_child(name, __cxa_demangle_node_scope);
+        const __cxa_demangle_node* args =
+            __cxa_demangle_node_child(name, __cxa_demangle_node_template_args);
+        std::string whole;
+        if (scope != 0)
+            whole = std::string(scope->text) + "::";
+        whole += __cxa_demangle_node_child(name,
+                                           __cxa_demangle_node_base_name)->text;
+        if (args != 0)
+            whole += args->text;
+        assert(whole == name->text);
+    }
+    std::free(plain);
+    __cxa_demangle_tree_destroy(tree);
+}
+
+int main()
+{
+    __cxa_demangle_context* context = __cxa_demangle_context_create();
+    assert(context != 0);
+    for (int round = 0; round < 2; ++round)
+    {
+        for (unsigned i = 0; i < NT; ++i)
+            check(round == 0 ? 0 : context, tree_cases[i]);
+        for (unsigned i = 0; i < NI; ++i)
+        {
+            int status;
+            assert(__cxa_demangle_tree_create(context, invalid_cases[i],
+                                              &status) == 0);
+            assert(status == -2);
+        }
+        for (unsigned i = 0; i < N; ++i)
+            check_round_trip(round == 0 ? 0 : context, cases[i][0]);
+    }
+    int status;
+    assert(__cxa_demangle_tree_create(context, 0, &status) == 0);
+    assert(status == -3);
+    assert(__cxa_demangle_tree_root(0) == 0);
+    assert(__cxa_demangle_tree_string(0) == 0);
+    __cxa_demangle_tree_destroy(0);
+    __cxa_demangle_context_destroy(context);
+}
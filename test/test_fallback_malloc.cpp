@@ -9,6 +9,7 @@
 
 #include <iostream>
 #include <deque>
+#include <vector>
 
 #include <pthread.h>
 
@@ -66,16 +67,23 @@ void *pop ( container &c, bool from_end ) {
     return ptr;
     }
 
-void exhaustion_test1 () {
+size_t thread_share () {
+    return heap_size / 8 < max_block_size ? max_block_size : heap_size / 8;
+    }
+
+int exhaustion_test1 () {
     container ptrs;
     
     init_heap ();
     std::cout << "Constant exhaustion tests" << std::endl;
     
-//  Delete in allocation order
+//  Delete in allocation order.  Even alone, this thread gets only its share.
     ptrs = alloc_series ( 32 );
     std::cout << "Allocated " << ptrs.size () << " 32 byte chunks" << std::endl;
-    print_free_list ();
+    if ( ptrs.size () != thread_share () / min_block_size ) {
+        std::cout << "### thread did not get exactly its share!!" << std::endl;
+        return 1;
+        }
     for ( container::iterator iter = ptrs.begin (); iter != ptrs.end (); ++iter )
         fallback_free ( *iter );
     print_free_list ();
@@ -95,6 +103,7 @@ void exhaustion_test1 () {
     while ( ptrs.size () > 0 )
         fallback_free ( pop ( ptrs, ptrs.size () % 1 == 1 ));
     print_free_list ();
+    return 0;
     }
             
 void exhaustion_test2 () {
@@ -164,12 +173,91 @@ void exhaustion_test3 () {
     
     }
 
-    
+void *exhaust_share ( void *parm ) {
+    container *ptrs = static_cast<container *>( parm );
+    *ptrs = alloc_series ( 32 );
+    return NULL;
+    }
+
+//  Enough threads each taking their share exhaust the heap between them
+int share_exhaustion_test () {
+    const size_t count = heap_size / thread_share ();
+    std::vector<container> ptrs ( count );
+    std::vector<pthread_t> threads ( count );
+    init_heap ();
+
+    std::cout << "Shared exhaustion tests" << std::endl;
+    for ( size_t i = 0; i < count; ++i ) {
+        pthread_create ( &threads [ i ], NULL, exhaust_share, &ptrs [ i ] );
+        pthread_join ( threads [ i ], NULL );
+        }
+    int failures = 0;
+    if ( 0 != print_free_list () || NULL != fallback_malloc ( 32 )) {
+        std::cout << "### heap not exhausted!!" << std::endl;
+        failures = 1;
+        }
+    for ( size_t i = 0; i < count; ++i )
+        for ( container::iterator iter = ptrs [ i ].begin (); iter != ptrs [ i ].end (); ++iter )
+            fallback_free ( *iter );
+    print_free_list ();
+    return failures;
+    }
+
+//  One thread using up its share of the heap must not starve the others
+int reserve_test () {
+    container ptrs;
+    pthread_t t;
+    init_heap ();
+
+    std::cout << "Per-thread reserve tests" << std::endl;
+    void *held = fallback_malloc ( 32 );
+    pthread_create ( &t, NULL, exhaust_share, &ptrs );
+    pthread_join ( t, NULL );
+    std::cout << "Other thread allocated " << ptrs.size () << " 32 byte chunks" << std::endl;
+    if ( ptrs.size () * min_block_size > heap_size / 8 ) {
+        std::cout << "### other thread took more than its share!!" << std::endl;
+        return 1;
+        }
+
+    void *p = fallback_malloc ( 32 );
+    std::cout << "fallback_malloc ( 32 ) --> " << p << std::endl;
+    if ( NULL == p ) {
+        std::cout << "### starved by the other thread!!" << std::endl;
+        return 1;
+        }
+    fallback_free ( p );
+    fallback_free ( held );
+    for ( container::iterator iter = ptrs.begin (); iter != ptrs.end (); ++iter )
+        fallback_free ( *iter );
+    print_free_list ();
+    return 0;
+    }
+
+//  Setting the size of the heap must not throw away blocks already handed
+//  out
+int resize_test () {
+    init_heap ();
+
+    std::cout << "Resize tests" << std::endl;
+    void *p = fallback_malloc ( 32 );
+    const char *old_heap = heap;
+    const size_t old_size = heap_size;
+    setenv ( "LIBCXXABI_EMERGENCY_POOL_SIZE", "1048576", 1 );
+    init_heap_size ();
+    if ( heap != old_heap || heap_size != old_size || !is_fallback_ptr ( p )) {
+        std::cout << "### heap resized while in use!!" << std::endl;
+        return 1;
+        }
+    fallback_free ( p );
+    print_free_list ();
+    return 0;
+    }
+
 int main ( int argc, char *argv [] ) {
     print_free_list ();
 
-    char *p = (char *) fallback_malloc ( 1024 );    // too big!
-    std::cout << "fallback_malloc ( 1024 ) --> " << (unsigned long ) p << std::endl;
+    char *p = (char *) fallback_malloc ( 8192 );    // too big!
+    std::cout << "fallback_malloc ( 8192 ) --> " << (unsigned long ) p << std::endl;
     print_free_list ();
     
     p = (char *) fallback_malloc ( 32 );
@@ -182,8 +270,11 @@ int main ( int argc, char *argv [] ) {
     print_free_list ();
     
     std::cout << std::endl;
-    exhaustion_test1 (); std::cout << std::endl;
+    int failures = exhaustion_test1 (); std::cout << std::endl;
     exhaustion_test2 (); std::cout << std::endl;
     exhaustion_test3 (); std::cout << std::endl;
-    return 0;
+    failures += share_exhaustion_test (); std::cout << std::endl;
+    failures += reserve_test (); std::cout << std::endl;
+    failures += resize_test ();
+    return failures;
     }
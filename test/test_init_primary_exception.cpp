@@ -0,0 +1,110 @@
+//===------------------ test_init_primary_exception.cpp -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "cxxabi.h"
+
+#include <cassert>
+#include <new>
+#include <typeinfo>
+
+int constructed = 0;
+int destroyed = 0;
+
+struct A
+{
+    int id;
+    explicit A(int i) : id(i) {++constructed;}
+    A(const A& a) : id(a.id) {++constructed;}
+    ~A() {++destroyed;}
+};
+
+void destroy_A(void* p)
+{
+    static_cast<A*>(p)->~A();
+}
+
+void* make_primary(int id)
+{
+    void* object = abi::__cxa_allocate_exception(sizeof(A));
+    new (object) A(id);
+    abi::__cxa_init_primary_exception(object, const_cast<std::type_info*>(&typeid(A)),
+                                      destroy_A);
+    abi::__cxa_increment_exception_refcount(object);
+    return object;
+}
+
+// An exception that is never thrown is destroyed with its last reference.
+void test_never_thrown()
+{
+    constructed = destroyed = 0;
+    void* p = make_primary(1);
+    assert(constructed == 1);
+    assert(destroyed == 0);
+    abi::__cxa_decrement_exception_refcount(p);
+    assert(destroyed == 1);
+}
+
+// It can be thrown later, and outlives the handler while still referenced.
+void test_rethrow()
+{
+    constructed = destroyed = 0;
+    void* p = make_primary(2);
+    try
+    {
+        abi::__cxa_rethrow_primary_exception(p);
+        assert(false);
+    }
+    catch (A& a)
+    {
+        assert(&a == p);
+        assert(a.id == 2);
+        void* current = abi::__cxa_current_primary_exception();
+        assert(current == p);
+        abi::__cxa_decrement_exception_refcount(current);
+    }
+    assert(destroyed == 0);
+    abi::__cxa_decrement_exception_refcount(p);
+    assert(destroyed == 1);
+}
+
+// A thrown exception can be captured by reference counting and thrown again.
+void test_capture()
+{
+    constructed = destroyed = 0;
+    void* p = make_primary(3);
+    void* q = 0;
+    try
+    {
+        abi::__cxa_rethrow_primary_exception(p);
+    }
+    catch (...)
+    {
+        q = abi::__cxa_current_primary_exception();
+    }
+    assert(q == p);
+    abi::__cxa_decrement_exception_refcount(p);
+    assert(destroyed == 0);
+    try
+    {
+        abi::__cxa_rethrow_primary_exception(q);
+    }
+    catch (const A& a)
+    {
+        assert(a.id == 3);
+    }
+    abi::__cxa_decrement_exception_refcount(q);
+    assert(destroyed == 1);
+}
+
+int main()
+{
+    test_never_thrown();
+    test_rethrow();
+    test_capture();
+}
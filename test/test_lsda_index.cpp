@@ -0,0 +1,108 @@
+//===------------------------- test_lsda_index.cpp ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Throws from every call site of a function with a long call-site table, so
+// that the personality routine has to find each one, and from several
+// threads at once so that they race to index the table.
+
+#include <cassert>
+#include <thread>
+#include <vector>
+
+template <int N> struct tag {};
+
+int destroyed = 0;
+
+struct cleanup
+{
+    ~cleanup() {++destroyed;}
+};
+
+// Throws tag<N> if n == N, or an int if n == -N - 1.
+template <int N>
+__attribute__((noinline))
+void maybe_throw(int n)
+{
+    if (n == N)
+        throw tag<N>();
+    if (n == -N - 1)
+        throw N;
+}
+
+#define SITE(N)                     \
+    try                             \
+    {                               \
+        cleanup c;                  \
+        maybe_throw<N>(n);          \
+    }                               \
+    catch (tag<N>&)                 \
+    {                               \
+        return N;                   \
+    }
+
+#define SITES_8(N) SITE(N + 0) SITE(N + 1) SITE(N + 2) SITE(N + 3) \
+                   SITE(N + 4) SITE(N + 5) SITE(N + 6) SITE(N + 7)
+
+const int sites = 64;
+
+// Returns the number of the call site that threw, or -1 if none did.
+__attribute__((noinline))
+int many_call_sites(int n)
+{
+    SITES_8(0) SITES_8(8) SITES_8(16) SITES_8(24)
+    SITES_8(32) SITES_8(40) SITES_8(48) SITES_8(56)
+    return -1;
+}
+
+void test_all_sites()
+{
+    for (int i = 0; i < sites; ++i)
+        assert(many_call_sites(i) == i);
+    assert(many_call_sites(sites) == -1);
+}
+
+// An exception no call site catches runs the cleanup and leaves the function.
+void test_uncaught()
+{
+    for (int i = 0; i < sites; ++i)
+    {
+        int before = destroyed;
+        try
+        {
+            many_call_sites(-i - 1);
+            assert(false);
+        }
+        catch (int n)
+        {
+            assert(n == i);
+        }
+        assert(destroyed == before + i + 1);
+    }
+}
+
+void test_threads()
+{
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t)
+        threads.push_back(std::thread([] {
+            for (int j = 0; j < 20; ++j)
+                for (int i = 0; i < sites; ++i)
+                    if (many_call_sites(i) != i)
+                        __builtin_trap();
+        }));
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+int main()
+{
+    test_all_sites();
+    test_uncaught();
+    test_threads();
+}
@@ -0,0 +1,128 @@
+//===--------------------- test_type_name_table.cpp -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is dual licensed under the MIT and the University of Illinois Open
+// Source Licenses. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+// Compares type_info's by name the way private_typeinfo.cpp does with
+// _LIBCXX_DYNAMIC_FALLBACK or on Windows, using several type_info's for each
+// name as separately loaded libraries would have.  The tables are made small
+// so that the test also fills them and falls back to strcmp.
+
+#include <stdint.h>
+#include <string.h>
+#include <typeinfo>
+
+#include <cassert>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LIBCXXABI_TYPE_NAME_SLOTS 8
+#include "../src/config.h"
+#include "../src/type_name_table.ipp"
+
+struct named_type : std::type_info
+{
+    explicit named_type(const char* name) : std::type_info(name) {}
+};
+
+// type_info's whose names are equal but are separate copies.  The tables
+// keep every type_info they see for the life of the process, so these are
+// never freed.
+struct named_types
+{
+    std::vector<std::string> names;
+    std::vector<named_type*> types;
+
+    named_types(const char* name, size_t copies) : names(copies, name)
+    {
+        for (size_t i = 0; i < copies; ++i)
+            types.push_back(new named_type(names[i].c_str()));
+    }
+};
+
+void test_same_and_different_names()
+{
+    named_types& a = *new named_types("1A", 3);
+    named_types& b = *new named_types("1B", 2);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (size_t i = 0; i < a.types.size(); ++i)
+            for (size_t j = 0; j < a.types.size(); ++j)
+                assert(is_same_type_name(a.types[i], a.types[j]));
+        for (size_t i = 0; i < a.types.size(); ++i)
+            for (size_t j = 0; j < b.types.size(); ++j)
+            {
+                assert(!is_same_type_name(a.types[i], b.types[j]));
+                assert(!is_same_type_name(b.types[j], a.types[i]));
+            }
+    }
+#if LIBCXXABI_TYPE_NAME_SLOTS > 0
+    // The comparisons above went through the tables.
+    const std::type_info* canonical = canonical_type(a.types[0]);
+    assert(canonical != 0);
+    assert(canonical_type(a.types[2]) == canonical);
+    assert(canonical_type(b.types[1]) != canonical);
+#endif
+}
+
+void test_threads()
+{
+    named_types& c = *new named_types("1C", 2);
+    named_types& d = *new named_types("1D", 2);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.push_back(std::thread([&c, &d, t] {
+            for (int i = 0; i < 1000; ++i)
+            {
+                size_t x = static_cast<size_t>(t + i) % 2;
+                assert(is_same_type_name(c.types[x], c.types[1 - x]));
+                assert(is_same_type_name(d.types[1 - x], d.types[x]));
+                assert(!is_same_type_name(c.types[x], d.types[x]));
+            }
+        }));
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+// A type_info with a different name at the address of one already linked,
+// as when a library is unloaded and another loaded in its place.
+void test_reused_address()
+{
+    named_types& r = *new named_types("1R", 2);
+    named_types& s = *new named_types("1S", 1);
+    assert(is_same_type_name(r.types[0], r.types[1]));
+    std::string* name = new std::string("1S");
+    r.types[1]->~named_type();
+    named_type* reused = new (r.types[1]) named_type(name->c_str());
+    assert(is_same_type_name(reused, s.types[0]));
+    assert(!is_same_type_name(reused, r.types[0]));
+}
+
+// Many more names than the tables hold.  Names that did not fit are
+// compared with strcmp, and must give the same answers.
+void test_full_tables()
+{
+    std::vector<named_types*> all;
+    for (int i = 0; i < 100; ++i)
+        all.push_back(new named_types(("1T" + std::to_string(i)).c_str(), 2));
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        assert(is_same_type_name(all[i]->types[0], all[i]->types[1]));
+        assert(!is_same_type_name(all[i]->types[0],
+                                  all[(i + 1) % all.size()]->types[1]));
+    }
+}
+
+int main()
+{
+    test_same_and_different_names();
+    test_threads();
+    test_reused_address();
+    test_full_tables();
+}